@@ -0,0 +1,441 @@
+// Microbenchmarks of the render kernels. Each kernel runs over a fixed set
+// of generated inputs: after a warm-up, every repetition times enough
+// passes over the set to last --min-time seconds. The results are printed
+// as JSON with the mean and 95% confidence interval of ns/op and
+// throughput over the repetitions.
+//
+// With --scaling it instead renders generated scenes of growing size at
+// growing thread counts and prints CSV, see scaling.h.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "perlin.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+#include "triangle.h"
+
+#include "scaling.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#ifndef RAYTRACER_ASSETS_DIR
+#define RAYTRACER_ASSETS_DIR "assets"
+#endif
+
+struct options {
+  int repetitions = 10;
+  double min_time = 0.05;  // Seconds per repetition
+  std::string filter;      // Runs only kernels whose name contains this
+  std::string output;      // JSON or CSV file; stdout when empty
+  bool scaling = false;
+  scaling_options sweep;
+} opts;
+
+// A kernel performs `ops` operations over its inputs per call of `run`,
+// which returns a checksum so the work cannot be optimized away. `unit`
+// names what an operation is: "rays" for intersection and scattering
+// kernels, "ops" for the rest.
+struct kernel {
+  std::string name;
+  std::string unit;
+  size_t ops;
+  std::function<uint64_t()> run;
+};
+
+struct estimate {
+  double mean = 0;
+  double ci95 = 0;  // Half-width of the 95% confidence interval
+};
+
+struct result {
+  const kernel* k;
+  estimate ns_per_op;
+  estimate throughput;  // Millions of `unit` per second
+  int passes;
+  uint64_t checksum;
+};
+
+// Two-sided 95% quantile of Student's t distribution.
+double t_quantile(int dof) {
+  static const double table[] = {
+      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (dof < 1) return 0;
+  return dof <= 30 ? table[dof - 1] : 1.96;
+}
+
+estimate summarize(const std::vector<double>& samples) {
+  estimate e;
+  const size_t n = samples.size();
+  for (double s : samples) e.mean += s;
+  e.mean /= n;
+  if (n < 2) return e;
+
+  double m2 = 0;
+  for (double s : samples) m2 += (s - e.mean) * (s - e.mean);
+  e.ci95 = t_quantile(int(n) - 1) * std::sqrt(m2 / (n - 1) / n);
+  return e;
+}
+
+result measure(const kernel& k) {
+  using clock = std::chrono::steady_clock;
+  auto seconds = [](clock::time_point a, clock::time_point b) {
+    return std::chrono::duration<double>(b - a).count();
+  };
+
+  // The first pass warms the caches and sizes the repetitions.
+  uint64_t checksum = 0;
+  auto start = clock::now();
+  checksum += k.run();
+  const double pass_time = std::max(1e-9, seconds(start, clock::now()));
+  const int passes = std::max(1, int(std::ceil(opts.min_time / pass_time)));
+  for (int p = 0; p < passes; p++) checksum += k.run();
+
+  std::vector<double> ns_per_op, throughput;
+  for (int r = 0; r < opts.repetitions; r++) {
+    start = clock::now();
+    for (int p = 0; p < passes; p++) checksum += k.run();
+    const double elapsed = seconds(start, clock::now());
+    const double ops = double(k.ops) * passes;
+    ns_per_op.push_back(1e9 * elapsed / ops);
+    throughput.push_back(ops / elapsed / 1e6);
+  }
+
+  return {&k, summarize(ns_per_op), summarize(throughput), passes, checksum};
+}
+
+// ---- Inputs ------------------------------------------------------------------
+
+point3 random_in_ball(pcg32& rng, real radius) {
+  for (;;) {
+    vec3<real> p(2 * rng.next_double() - 1, 2 * rng.next_double() - 1,
+                 2 * rng.next_double() - 1);
+    if (p.length_squared() <= 1) return radius * p;
+  }
+}
+
+vec3<real> random_direction(pcg32& rng) {
+  return unit_vector(random_in_ball(rng, 1));
+}
+
+// Rays from random points at distance `from` of `center` towards random
+// points within `to` of it.
+std::vector<ray> ray_set(size_t count, const point3& center, real from,
+                         real to, uint64_t seed) {
+  pcg32 rng(seed, 1);
+  std::vector<ray> rays;
+  rays.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    const point3 origin = center + from * random_direction(rng);
+    const point3 target = center + random_in_ball(rng, to);
+    rays.emplace_back(origin, target - origin, rng.next_double());
+  }
+  return rays;
+}
+
+// Intersects every ray of `rays` with `object`; the checksum counts hits.
+template <typename T>
+kernel hit_kernel(const std::string& name, std::shared_ptr<T> object,
+                  std::vector<ray> rays) {
+  return {name, "rays", rays.size(), [object, rays] {
+            uint64_t hits = 0;
+            hit_record rec;
+            for (const auto& r : rays) {
+              hits += object->hit(r, interval(0.001, infinity), rec);
+            }
+            return hits;
+          }};
+}
+
+hittable_list random_spheres(size_t count, real extent, uint64_t seed) {
+  pcg32 rng(seed, 2);
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  hittable_list list;
+  for (size_t i = 0; i < count; i++) {
+    list.add(make_shared<sphere>(random_in_ball(rng, extent),
+                                 0.2 + 0.8 * rng.next_double(), mat));
+  }
+  return list;
+}
+
+hittable_list random_triangles(size_t count, real extent, uint64_t seed) {
+  pcg32 rng(seed, 3);
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  hittable_list list;
+  for (size_t i = 0; i < count; i++) {
+    list.add(make_shared<triag>(random_in_ball(rng, extent),
+                                random_in_ball(rng, 1),
+                                random_in_ball(rng, 1), mat));
+  }
+  return list;
+}
+
+// Scatters rays arriving from random directions at random points of the
+// plane y = 0 off `mat`; the checksum counts scattered rays.
+kernel scatter_kernel(const std::string& name, shared_ptr<material> mat,
+                      size_t count) {
+  pcg32 rng(0x5ca7, 4);
+  std::vector<ray> rays;
+  std::vector<hit_record> recs(count);
+  for (size_t i = 0; i < count; i++) {
+    auto& rec = recs[i];
+    rec.p = point3(4 * rng.next_double() - 2, 0, 4 * rng.next_double() - 2);
+    rec.t = 1;
+    rec.u = rng.next_double();
+    rec.v = rng.next_double();
+    rec.mat = mat.get();
+    auto direction = random_direction(rng);
+    rays.emplace_back(rec.p - direction, direction, 0);
+    rec.set_face_normal(rays.back(), vec3<real>(0, 1, 0));
+  }
+
+  return {name, "rays", count, [mat, rays, recs] {
+            uint64_t scattered_rays = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+              color attenuation;
+              ray scattered;
+              scattered_rays +=
+                  mat->scatter(rays[i], recs[i], attenuation, scattered);
+            }
+            return scattered_rays;
+          }};
+}
+
+std::vector<kernel> kernels() {
+  const size_t ray_count = 1 << 16;
+  std::vector<kernel> list;
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+  list.push_back(hit_kernel(
+      "sphere::hit", make_shared<sphere>(point3(0, 0, 0), 1.0, mat),
+      ray_set(ray_count, point3(0, 0, 0), 4, 1.5, 1)));
+  list.push_back(hit_kernel(
+      "quad::hit",
+      make_shared<quad>(point3(-1, -1, 0), vec3<real>(2, 0, 0),
+                        vec3<real>(0, 2, 0), mat),
+      ray_set(ray_count, point3(0, 0, 0), 4, 1.5, 2)));
+  list.push_back(hit_kernel(
+      "triag::hit",
+      make_shared<triag>(point3(-1, -1, 0), vec3<real>(2, 0, 0),
+                         vec3<real>(0, 2, 0), mat),
+      ray_set(ray_count, point3(0, 0, 0), 4, 1.5, 3)));
+
+  auto box = aabb(point3(-1, -1, -1), point3(1, 1, 1));
+  auto box_rays = ray_set(ray_count, point3(0, 0, 0), 4, 2, 4);
+  list.push_back({"aabb::hit", "rays", box_rays.size(), [box, box_rays] {
+                    uint64_t hits = 0;
+                    for (const auto& r : box_rays) {
+                      hits += box.hit(r, interval(0.001, infinity));
+                    }
+                    return hits;
+                  }});
+
+  // Rays from outside each scene through its volume, at the density of a
+  // camera looking into it.
+  for (size_t count : {size_t(1000), size_t(100000)}) {
+    list.push_back(hit_kernel(
+        "bvh_node::hit/spheres-" + std::to_string(count),
+        make_shared<bvh_node>(random_spheres(count, 50, count)),
+        ray_set(ray_count, point3(0, 0, 0), 120, 50, 5)));
+  }
+  list.push_back(hit_kernel(
+      "bvh_node::hit/triangles-100000",
+      make_shared<bvh_node>(random_triangles(100000, 50, 6)),
+      ray_set(ray_count, point3(0, 0, 0), 120, 50, 6)));
+
+  auto noise = std::make_shared<perlin>();
+  std::vector<point3> points;
+  pcg32 rng(0x7e57, 5);
+  for (size_t i = 0; i < ray_count; i++) points.push_back(random_in_ball(rng, 10));
+  list.push_back({"perlin::turb", "ops", points.size(), [noise, points] {
+                    double sum = 0;
+                    for (const auto& p : points) sum += noise->turb(p, 7);
+                    return uint64_t(std::fabs(sum));
+                  }});
+
+  auto earth = std::make_shared<image_texture>(RAYTRACER_ASSETS_DIR
+                                               "/earthmap.jpg");
+  list.push_back({"image_texture::value", "ops", points.size(), [earth, points] {
+                    double sum = 0;
+                    for (const auto& p : points) {
+                      const real u = p.x() / 20 + 0.5, v = p.y() / 20 + 0.5;
+                      sum += earth->value(u, v, p).x();
+                    }
+                    return uint64_t(sum);
+                  }});
+
+  list.push_back(scatter_kernel("lambertian::scatter",
+                                make_shared<lambertian>(color(0.5, 0.5, 0.5)),
+                                ray_count));
+  list.push_back(scatter_kernel(
+      "metal::scatter", make_shared<metal>(color(0.8, 0.8, 0.8), 0.3),
+      ray_count));
+  list.push_back(scatter_kernel("dielectric::scatter",
+                                make_shared<dielectric>(1.5), ray_count));
+  list.push_back(scatter_kernel("isotropic::scatter",
+                                make_shared<isotropic>(color(0.8, 0.8, 0.8)),
+                                ray_count));
+  return list;
+}
+
+// ---- Output ------------------------------------------------------------------
+
+void write_json(std::ostream& out, const std::vector<result>& results) {
+  out << std::setprecision(6);
+  out << "{\n"
+      << "  \"precision\": \"" << (sizeof(real) == 4 ? "float" : "double")
+      << "\",\n"
+      << "  \"repetitions\": " << opts.repetitions << ",\n"
+      << "  \"min_time_s\": " << opts.min_time << ",\n"
+      << "  \"kernels\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& r = results[i];
+    const std::string rate = r.k->unit == "rays" ? "mrays_per_s" : "mops_per_s";
+    out << (i ? "," : "") << "\n    {\"name\": \"" << r.k->name
+        << "\", \"ops_per_pass\": " << r.k->ops
+        << ", \"passes\": " << r.passes
+        << ", \"ns_per_op\": " << r.ns_per_op.mean
+        << ", \"ns_per_op_ci95\": " << r.ns_per_op.ci95
+        << ", \"" << rate << "\": " << r.throughput.mean
+        << ", \"" << rate << "_ci95\": " << r.throughput.ci95
+        << ", \"checksum\": " << r.checksum << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// Splits "a,b,c" and converts every item with `convert`.
+template <typename T, typename F>
+std::vector<T> parse_list(const std::string& value, F&& convert) {
+  std::vector<T> items;
+  size_t begin = 0;
+  while (begin <= value.size()) {
+    size_t end = value.find(',', begin);
+    if (end == std::string::npos) end = value.size();
+    if (end > begin) items.push_back(convert(value.substr(begin, end - begin)));
+    begin = end + 1;
+  }
+  return items;
+}
+
+bool parse_option(const std::string& arg) {
+  if (arg.rfind("--", 0) != 0) return false;
+
+  auto eq = arg.find('=');
+  auto key = arg.substr(2, eq == std::string::npos ? eq : eq - 2);
+  auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+  if (key == "repetitions") {
+    opts.repetitions = std::max(1, std::atoi(value.c_str()));
+  } else if (key == "min-time") {
+    opts.min_time = std::atof(value.c_str());
+  } else if (key == "filter") {
+    opts.filter = value;
+  } else if (key == "output") {
+    opts.output = value;
+  } else if (key == "scaling") {
+    opts.scaling = true;
+  } else if (key == "kinds") {
+    opts.sweep.kinds = parse_list<std::string>(
+        value, [](const std::string& item) { return item; });
+  } else if (key == "sizes") {
+    // Accepts 1e6 as well as 1000000.
+    opts.sweep.sizes = parse_list<size_t>(value, [](const std::string& item) {
+      return size_t(std::atof(item.c_str()));
+    });
+  } else if (key == "threads") {
+    opts.sweep.threads = parse_list<int>(value, [](const std::string& item) {
+      return std::max(1, std::atoi(item.c_str()));
+    });
+  } else if (key == "width") {
+    opts.sweep.width = std::max(1, std::atoi(value.c_str()));
+  } else if (key == "spp") {
+    opts.sweep.spp = std::max(1, std::atoi(value.c_str()));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (!parse_option(argv[i])) {
+      std::cerr << "Unknown option: " << argv[i] << "\n"
+                << "Usage: " << argv[0]
+                << " [--repetitions=N] [--min-time=S] [--filter=NAME]"
+                   " [--output=FILE]\n"
+                << "       " << argv[0]
+                << " --scaling [--kinds=spheres,quads,triangles,instances]"
+                   " [--sizes=1e3,1e4,...] [--threads=1,2,...] [--width=N]"
+                   " [--spp=N] [--output=FILE]\n";
+      return 1;
+    }
+  }
+
+  if (opts.scaling) {
+    for (const auto& kind : opts.sweep.kinds) {
+      if (kind != "spheres" && kind != "quads" && kind != "triangles" &&
+          kind != "instances") {
+        std::cerr << "ERROR: Unknown scene kind: " << kind << "\n";
+        return 1;
+      }
+    }
+    if (opts.output.empty()) {
+      run_scaling(opts.sweep, std::cout);
+      return 0;
+    }
+    std::ofstream file(opts.output);
+    run_scaling(opts.sweep, file);
+    if (!file) {
+      std::cerr << "ERROR: Could not write " << opts.output << "\n";
+      return 1;
+    }
+    std::clog << "Results: " << opts.output << "\n";
+    return 0;
+  }
+
+  // Materials and noise draw from the thread's generator.
+  thread_rng().seed(0xbe4c, 0);
+
+  const auto list = kernels();
+  std::vector<result> results;
+  for (const auto& k : list) {
+    if (k.name.find(opts.filter) == std::string::npos) continue;
+    results.push_back(measure(k));
+    const auto& r = results.back();
+    std::clog << std::left << std::setw(32) << k.name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(10)
+              << r.ns_per_op.mean << " +- " << std::setw(6)
+              << r.ns_per_op.ci95 << " ns/op\n";
+  }
+
+  if (opts.output.empty()) {
+    write_json(std::cout, results);
+    return 0;
+  }
+
+  std::ofstream file(opts.output);
+  write_json(file, results);
+  if (!file) {
+    std::cerr << "ERROR: Could not write " << opts.output << "\n";
+    return 1;
+  }
+  std::clog << "Results: " << opts.output << "\n";
+  return 0;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+// Scene-size and thread-count sweep for raytracer_bench --scaling. Every
+// scene kind is generated at each size with the same primitive density, so
+// the camera sees a similar image and only the acceleration structures
+// grow. Each scene is rendered at every thread count twice:
+//   strong  the same frame at every thread count
+//   weak    a frame with about `threads` times the pixels
+// Efficiency is the ray throughput per thread relative to the smallest
+// thread count, usually one.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+struct scaling_options {
+  std::vector<std::string> kinds = {"spheres", "quads", "triangles",
+                                    "instances"};
+  std::vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+  std::vector<int> threads;  // 1, 2, 4, ... up to every core when empty
+  int width = 192;           // Of the strong scaling frame
+  int spp = 4;
+};
+
+// Heap bytes currently allocated, 0 where unsupported. Unlike the resident
+// size this drops when a scene is freed, so consecutive scenes can be
+// measured in one process.
+inline size_t heap_bytes_in_use() {
+#if defined(__APPLE__)
+  malloc_statistics_t stats;
+  malloc_zone_statistics(nullptr, &stats);
+  return stats.size_in_use;
+#elif defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const auto info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+struct generated_scene {
+  hittable_list world;
+  real extent = 0;      // Half the edge of the cube the primitives fill
+  double build_ms = 0;  // Acceleration structure construction
+};
+
+// Random triangles with corners within `size` of points drawn by
+// `center_of()`.
+template <typename F>
+mesh_data random_triangle_soup(size_t count, F&& center_of, real size,
+                               pcg32& rng) {
+  auto in_ball = [&](real r) {
+    for (;;) {
+      vec3<real> p(2 * rng.next_double() - 1, 2 * rng.next_double() - 1,
+                   2 * rng.next_double() - 1);
+      if (p.length_squared() <= 1) return r * p;
+    }
+  };
+
+  mesh_data mesh;
+  for (size_t i = 0; i < count; i++) {
+    const point3 center = center_of();
+    for (int k = 0; k < 3; k++) {
+      const point3 p = center + in_ball(size);
+      mesh.positions.push_back(vec3<float>(p.x(), p.y(), p.z()));
+      mesh.indices.push_back(uint32_t(mesh.positions.size() - 1));
+    }
+  }
+  return mesh;
+}
+
+// `count` primitives of `kind` in a cube whose volume grows with the count.
+// Instanced scenes place copies of one 1024-triangle mesh, so `count` is
+// the number of triangles they show, not the number stored. Each copy
+// spans the volume its triangles would get in the other scenes, so all
+// kinds have the same density.
+inline generated_scene generate_scene(const std::string& kind, size_t count) {
+  using clock = std::chrono::steady_clock;
+  pcg32 rng(count, 7);
+  generated_scene scene;
+  auto extent_of = [](size_t n) { return real(0.5 * std::cbrt(20.0 * n)); };
+  scene.extent = extent_of(count);
+  auto in_cube = [&] {
+    return scene.extent * vec3<real>(2 * rng.next_double() - 1,
+                                     2 * rng.next_double() - 1,
+                                     2 * rng.next_double() - 1);
+  };
+  auto direction = [&] {
+    return unit_vector(vec3<real>(rng.next_double() - 0.5,
+                                  rng.next_double() - 0.5,
+                                  rng.next_double() - 0.5));
+  };
+  auto mat = make_shared<lambertian>(color(0.6, 0.6, 0.6));
+
+  hittable_list list;
+  if (kind == "spheres") {
+    for (size_t i = 0; i < count; i++) {
+      list.add(make_shared<sphere>(in_cube(), 0.5, mat));
+    }
+  } else if (kind == "quads") {
+    for (size_t i = 0; i < count; i++) {
+      const auto u = direction();
+      const auto v = unit_vector(cross(u, direction()));
+      list.add(make_shared<quad>(in_cube() - 0.5 * (u + v), u, v, mat));
+    }
+  } else if (kind == "triangles") {
+    auto soup = random_triangle_soup(count, in_cube, 0.5, rng);
+    auto start = clock::now();
+    scene.world.add(make_shared<triangle_mesh>(std::move(soup), mat));
+    scene.build_ms =
+        std::chrono::duration<double, std::milli>(clock::now() - start)
+            .count();
+    return scene;
+  } else if (kind == "instances") {
+    const size_t base_triangles = 1024;
+    auto start = clock::now();
+    const real base_extent = extent_of(base_triangles);
+    auto in_base = [&] {
+      return base_extent * vec3<real>(2 * rng.next_double() - 1,
+                                      2 * rng.next_double() - 1,
+                                      2 * rng.next_double() - 1);
+    };
+    auto base = make_shared<triangle_mesh>(
+        random_triangle_soup(base_triangles, in_base, 0.5, rng), mat);
+    const size_t copies = std::max<size_t>(1, count / base_triangles);
+    for (size_t i = 0; i < copies; i++) {
+      list.add(make_shared<instance>(
+          base, affine_transform::translation(in_cube()) *
+                    affine_transform::rotation(direction(),
+                                               360 * rng.next_double())));
+    }
+    scene.world.add(make_shared<bvh_node>(std::move(list)));
+    scene.build_ms =
+        std::chrono::duration<double, std::milli>(clock::now() - start)
+            .count();
+    return scene;
+  }
+
+  auto start = clock::now();
+  scene.world.add(make_shared<bvh_node>(std::move(list)));
+  scene.build_ms =
+      std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  return scene;
+}
+
+inline std::vector<int> default_thread_counts() {
+  const int cores = int(hardware_threads());
+  std::vector<int> counts;
+  for (int t = 1; t < cores; t *= 2) counts.push_back(t);
+  counts.push_back(cores);
+  return counts;
+}
+
+inline void run_scaling(const scaling_options& options, std::ostream& csv) {
+  auto threads =
+      options.threads.empty() ? default_thread_counts() : options.threads;
+  std::sort(threads.begin(), threads.end());
+  threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+  csv << "kind,primitives,scaling,threads,width,height,spp,build_ms,"
+         "memory_mb,seconds,mrays_per_s,efficiency\n";
+
+  for (const auto& kind : options.kinds) {
+    for (size_t size : options.sizes) {
+      const size_t heap_before = heap_bytes_in_use();
+      auto scene = generate_scene(kind, size);
+      const size_t heap_after = heap_bytes_in_use();
+      const double memory_mb =
+          heap_after > heap_before
+              ? (heap_after - heap_before) / (1024.0 * 1024.0)
+              : 0.0;
+
+      for (const char* scaling : {"strong", "weak"}) {
+        const bool weak = scaling[0] == 'w';
+        double base_rate = 0;  // Per thread, at the smallest count
+        for (int t : threads) {
+          camera cam;
+          cam.aspect_ratio      = 16.0 / 9.0;
+          cam.image_width       = weak ? int(std::lround(options.width *
+                                                         std::sqrt(t)))
+                                       : options.width;
+          cam.samples_per_pixel = options.spp;
+          cam.max_depth         = 8;
+          cam.background        = color(0.70, 0.80, 1.00);
+          cam.vfov              = 40;
+          cam.lookfrom = point3(1.2, 0.8, 2.4) * scene.extent;
+          cam.lookat   = point3(0, 0, 0);
+          cam.seed        = 1;
+          cam.num_threads = t;
+          cam.quiet       = true;
+          cam.render(scene.world, "");
+
+          const double rate = cam.rays_traced / cam.render_seconds / 1e6;
+          if (t == threads.front()) base_rate = rate / t;
+          const int height = int(cam.image_width / cam.aspect_ratio);
+
+          csv << kind << "," << size << "," << scaling << "," << t << ","
+              << cam.image_width << "," << height << "," << options.spp
+              << "," << std::fixed << std::setprecision(2) << scene.build_ms
+              << "," << memory_mb << "," << std::setprecision(3)
+              << cam.render_seconds << "," << rate << ","
+              << rate / (t * base_rate) << std::endl;
+        }
+      }
+    }
+  }
+}
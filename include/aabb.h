@@ -35,11 +35,11 @@ class aabb {
 
   bool hit(const ray& r, interval ray_t) const {
     const point3& ray_orig = r.origin();
-    const vec3<double>& ray_dir = r.direction();
+    const vec3<real>& ray_inv_dir = r.inverse_direction();
 
     for (int axis = 0; axis < 3; axis++) {
       const interval& ax = axis_interval(axis);
-      const double adinv = 1.0 / ray_dir[axis];
+      const real adinv = ray_inv_dir[axis];
 
       auto t0 = (ax.min - ray_orig[axis]) * adinv;
       auto t1 = (ax.max - ray_orig[axis]) * adinv;
@@ -59,6 +59,16 @@ class aabb {
     return true;
   }
 
+  real surface_area() const {
+    auto dx = x.size(), dy = y.size(), dz = z.size();
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+  }
+
+  point3 centroid() const {
+    return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max),
+                  0.5 * (z.min + z.max));
+  }
+
   int longest_axis() const {
     if (x.size() > y.size()) {
       return x.size() > z.size() ? 0 : 2;
@@ -70,18 +80,18 @@ class aabb {
   static const aabb empty, universe;
  private:
   void pad_to_minus() {
-    double delta = 0.0001;
+    real delta = 0.0001;
     if (x.size() < delta) x = x.expand(delta);
     if (y.size() < delta) y = y.expand(delta);
     if (z.size() < delta) z = z.expand(delta);
   }
 };
 
-inline aabb operator+(const aabb& bbox, const vec3<double>& offset) {
+inline aabb operator+(const aabb& bbox, const vec3<real>& offset) {
   return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
 
-inline aabb operator+(const vec3<double> offset, const aabb& bbox) {
+inline aabb operator+(const vec3<real> offset, const aabb& bbox) {
   return bbox + offset;
 }
 
@@ -1,98 +1,770 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "parallel.h"
+#include "primitive_store.h"
 
-class bvh_node : public hittable {
+// Split strategy used when building a BVH. `median` sorts along the longest
+// axis and splits at the object-count midpoint; `sah` bins primitive
+// centroids and picks the cheapest split under the Surface Area Heuristic.
+enum class bvh_split { median, sah };
+
+// Pointer-free BVH over a set of primitive bounding boxes. The tree is first
+// built as a binary BVH and then collapsed into a 4-wide BVH: each node holds
+// the bounds of up to four children in SoA single-precision layout, so one
+// SSE sequence tests the ray against all of them. Nodes live in a contiguous
+// array in depth-first order. A child is either another node or a leaf
+// covering the primitive range [child, child + count) of primitive_order().
+//
+// Construction is task parallel: large ranges hand their second child to
+// another thread and compute their bounds and SAH bins in parallel chunks.
+class bvh_tree {
  public:
-  bvh_node(hittable_list list) 
-  : bvh_node(list.objects, 0, list.objects.size()) {}
+  static const int width = 4;
+
+  struct alignas(64) wide_node {
+    // bounds[0] holds the lower and bounds[1] the upper corners, one row of
+    // `width` children per axis. Empty slots have inverted bounds.
+    float bounds[2][3][width];
+    uint32_t child[width];
+    uint16_t count[width];
+  };
+
+  void build(const std::vector<aabb>& bounds, bvh_split split) {
+    nodes.clear();
+    order.clear();
+    root_bbox = aabb::empty;
+    if (bounds.empty()) return;
+
+    std::vector<build_primitive> prims(bounds.size());
+    parallel_for(0, prims.size(), parallel_grain, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        prims[i] = {bounds[i], bounds[i].centroid(), uint32_t(i)};
+      }
+    });
+
+    std::vector<binary_node> binary;
+    binary.reserve(2 * prims.size());
+    build_recursive(prims, 0, prims.size(), split, 0, hardware_threads(),
+                    binary);
+    root_bbox = binary[0].bbox;
+
+    nodes.reserve(binary.size() / 2 + 1);
+    if (binary[0].count > 0) {
+      nodes.emplace_back();
+      clear_slots(nodes[0]);
+      set_slot(nodes[0], 0, binary[0], binary[0].offset);
+    } else {
+      collapse(binary, 0);
+    }
+
+    order.resize(prims.size());
+    parallel_for(0, prims.size(), parallel_grain, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) order[i] = prims[i].index;
+    });
+  }
+
+  // Index into the original bounds for every leaf slot. Callers reorder their
+  // primitives by this so leaves address them directly.
+  const std::vector<uint32_t>& primitive_order() const { return order; }
+
+  aabb bounds() const { return root_bbox; }
+
+  size_t node_count() const { return nodes.size(); }
 
-  bvh_node(
-    std::vector<shared_ptr<hittable>>& objects, 
-    size_t start, 
-    size_t end) 
-  {
-    bbox = aabb::empty;
+  // Visits the leaves pierced by `r`, nearest child first. For every primitive
+  // in a visited leaf `hit_primitive(index, ray_t)` is called; it returns true
+  // on a hit and shrinks ray_t.max to the hit distance.
+  template <typename F>
+  bool hit(const ray& r, interval ray_t, F&& hit_primitive) const {
+    if (nodes.empty()) return false;
 
-    for (size_t object_index = start; object_index < end; object_index++) {
-      bbox = aabb(bbox, objects[object_index]->bounding_box());
+    const ray_slabs slabs(r);
+
+    struct stack_entry {
+      uint32_t child;
+      uint16_t count;
+      float t_near;
+    };
+    stack_entry stack[stack_capacity];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, -std::numeric_limits<float>::infinity()};
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+      const stack_entry entry = stack[--stack_size];
+      if (entry.t_near > ray_t.max) continue;
+
+      if (entry.count > 0) {
+        for (uint32_t i = entry.child; i < entry.child + entry.count; i++) {
+          if (hit_primitive(i, ray_t)) hit_anything = true;
+        }
+        continue;
+      }
+
+      const wide_node& n = nodes[entry.child];
+      RT_STAT(bvh_nodes);
+      RT_STAT_ADD(aabb_tests, width);
+      alignas(16) float t_near[width];
+      int mask = intersect_children(n, slabs, ray_t, t_near);
+
+      // Push the children far to near so the nearest one is popped first.
+      int sorted[width];
+      int hits = 0;
+      for (int i = 0; i < width; i++) {
+        if (!(mask & (1 << i))) continue;
+        int j = hits++;
+        while (j > 0 && t_near[sorted[j - 1]] < t_near[i]) {
+          sorted[j] = sorted[j - 1];
+          j--;
+        }
+        sorted[j] = i;
+      }
+      for (int k = 0; k < hits; k++) {
+        int i = sorted[k];
+        stack[stack_size++] = {n.child[i], n.count[i], t_near[i]};
+      }
     }
 
+    return hit_anything;
+  }
+
+  // Packet traversal: every node is fetched once for all lanes, its children
+  // are tested against four lanes per SSE operation, and the lanes that still
+  // overlap a child travel down with it as a bit mask. For each primitive in
+  // a visited leaf and each lane reaching it, `hit_primitive(index, lane,
+  // ray_t)` is called as in hit().
+  template <typename F>
+  void hit_packet(ray_packet& packet, F&& hit_primitive) const {
+    if (nodes.empty() || !packet.active) return;
+
+    packet_slabs slabs(packet);
+
+    struct stack_entry {
+      uint32_t child;
+      uint16_t count;
+      uint32_t lanes;
+      float t_near;  // Nearest entry point over the lanes
+    };
+    stack_entry stack[stack_capacity];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, packet.active,
+                           -std::numeric_limits<float>::infinity()};
+
+    while (stack_size > 0) {
+      const stack_entry entry = stack[--stack_size];
+
+      // A lane whose closest hit is nearer than every lane's entry point
+      // cannot find anything closer below this node.
+      uint32_t lanes = 0;
+      for (int lane = 0; lane < ray_packet::size; lane++) {
+        lanes |= uint32_t(entry.t_near <= slabs.t_far[lane]) << lane;
+      }
+      lanes &= entry.lanes;
+      if (!lanes) continue;
+
+      if (entry.count > 0) {
+        for (uint32_t rest = lanes; rest; rest &= rest - 1) {
+          const int lane = lowest_bit(rest);
+          interval ray_t(packet.t_min, packet.t_max[lane]);
+          for (uint32_t i = entry.child; i < entry.child + entry.count; i++) {
+            if (hit_primitive(i, lane, ray_t)) {
+              packet.t_max[lane] = ray_t.max;
+              slabs.t_far[lane] = round_up(ray_t.max);
+              packet.hit |= 1u << lane;
+            }
+          }
+        }
+        continue;
+      }
+
+      const wide_node& n = nodes[entry.child];
+      RT_STAT(bvh_nodes);
+      RT_STAT_ADD(aabb_tests, width * bit_count(lanes));
+      uint32_t child_lanes[width];
+      float child_near[width];
+      intersect_packet(n, slabs, lanes, child_lanes, child_near);
+
+      // Far to near by the closest lane, as in hit().
+      int sorted[width];
+      int hits = 0;
+      for (int i = 0; i < width; i++) {
+        if (!child_lanes[i]) continue;
+        int j = hits++;
+        while (j > 0 && child_near[sorted[j - 1]] < child_near[i]) {
+          sorted[j] = sorted[j - 1];
+          j--;
+        }
+        sorted[j] = i;
+      }
+      for (int k = 0; k < hits; k++) {
+        int i = sorted[k];
+        stack[stack_size++] = {n.child[i], n.count[i], child_lanes[i],
+                               child_near[i]};
+      }
+    }
+  }
+
+ private:
+  static const int max_depth = 64;
+  static const int stack_capacity = (width - 1) * max_depth + 1;
+  static const uint32_t empty_slot = ~uint32_t(0);
+  static const int max_sah_depth = 31;
+  static const int sah_bins = 16;
+  static const size_t max_leaf_size = 4;
+  static const size_t parallel_grain = 1 << 14;
+  static const size_t parallel_task_span = 1 << 12;
+  static constexpr double traversal_cost = 0.125;
+
+  struct build_primitive {
+    aabb bounds;
+    point3 centroid;
+    uint32_t index;
+  };
+
+  struct sah_bin {
+    aabb bounds = aabb::empty;
+    size_t count = 0;
+  };
+
+  // Node of the intermediate binary tree. The first child of an interior node
+  // directly follows it and `offset` holds the index of the second child;
+  // leaves cover prims[offset, offset + count).
+  struct binary_node {
+    aabb bbox;
+    uint32_t offset = 0;
+    uint16_t count = 0;
+    uint8_t axis = 0;
+  };
+
+  // Ray origin and inverse direction rounded to float, plus which of the two
+  // slab planes is entered first along each axis.
+  struct ray_slabs {
+    float origin[3];
+    float inv_dir[3];
+    int near_side[3];
+
+    explicit ray_slabs(const ray& r) {
+      for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = float(r.origin()[axis]);
+        inv_dir[axis] = float(r.inverse_direction()[axis]);
+        near_side[axis] = r.inverse_direction()[axis] < 0 ? 1 : 0;
+      }
+    }
+  };
+
+  // Ray data of a whole packet in SoA layout, four lanes per SSE register.
+  // Lanes differ in which box plane is near, so the packet test takes the
+  // min and max of both planes; clamping the inverse direction to a finite
+  // value keeps 0 * inf NaNs out of that. Inactive lanes get a zero ray
+  // whose t_far of -inf fails every entry test; the caller masks them out
+  // as well.
+  struct packet_slabs {
+    alignas(16) float origin[3][ray_packet::size] = {};
+    alignas(16) float inv_dir[3][ray_packet::size] = {};
+    alignas(16) float t_far[ray_packet::size];
+    float t_min;
+
+    explicit packet_slabs(const ray_packet& packet)
+      : t_min(float(packet.t_min))
+    {
+      for (int lane = 0; lane < ray_packet::size; lane++) {
+        if (!(packet.active & (1u << lane))) {
+          t_far[lane] = -std::numeric_limits<float>::infinity();
+          continue;
+        }
+        const ray_slabs s(packet.rays[lane]);
+        for (int axis = 0; axis < 3; axis++) {
+          origin[axis][lane] = s.origin[axis];
+          inv_dir[axis][lane] =
+              std::fmax(std::fmin(s.inv_dir[axis], 1e30f), -1e30f);
+        }
+        t_far[lane] = round_up(packet.t_max[lane]);
+      }
+    }
+  };
+
+  std::vector<wide_node> nodes;
+  std::vector<uint32_t> order;
+  aabb root_bbox = aabb::empty;
+
+  // Appends the subtree over prims[start, end) to `out` using up to `threads`
+  // threads. Interior offsets are indices into `out`; leaf offsets are
+  // indices into `prims`.
+  void build_recursive(std::vector<build_primitive>& prims, size_t start,
+                       size_t end, bvh_split split, int depth,
+                       unsigned threads, std::vector<binary_node>& out) {
+    size_t node_index = out.size();
+    out.emplace_back();
+
+    aabb bbox, centroid_bounds;
+    compute_bounds(prims, start, end, threads, bbox, centroid_bounds);
+    out[node_index].bbox = bbox;
+
+    size_t span = end - start;
+    size_t mid = start;
     int axis = bbox.longest_axis();
 
-    auto comparator = (axis == 0) ? box_x_compare
-                    : (axis == 1) ? box_y_compare
-                                  : box_z_compare;
+    // Deep SAH chains could overflow the traversal stack, so past
+    // max_sah_depth fall back to median splits, which halve the span on
+    // every level.
+    if (split == bvh_split::sah && depth < max_sah_depth) {
+      double best_cost;
+      int best_split;
+      int best_axis =
+          find_sah_split(prims, start, end, threads, bbox, centroid_bounds,
+                         best_cost, best_split);
 
-    size_t object_span = end - start;
+      if (span <= max_leaf_size &&
+          (best_axis < 0 || double(span) <= best_cost)) {
+        make_leaf(out[node_index], start, span);
+        return;
+      }
 
-    if (object_span == 1) {
-      left = right = objects[start];
-    } else if (object_span == 2) {
-      left = objects[start];
-      right = objects[start+1];
-    } else {
-      std::sort(
-        std::begin(objects) + start,
-        std::begin(objects) + end,
-        comparator);
+      if (best_axis >= 0) {
+        const interval& extent = centroid_bounds.axis_interval(best_axis);
+        auto it = std::partition(
+            prims.begin() + start, prims.begin() + end,
+            [&](const build_primitive& p) {
+              return bin_index(p.centroid[best_axis], extent) <= best_split;
+            });
+        mid = size_t(it - prims.begin());
+        axis = best_axis;
+      }
+    } else if (span == 1) {
+      make_leaf(out[node_index], start, span);
+      return;
+    }
+
+    if (mid == start) {
+      // Median split; also taken when every centroid coincides and no plane
+      // can separate them.
+      mid = start + span / 2;
+      std::nth_element(prims.begin() + start, prims.begin() + mid,
+                       prims.begin() + end,
+                       [axis](const build_primitive& a,
+                              const build_primitive& b) {
+                         return a.bounds.axis_interval(axis).min <
+                                b.bounds.axis_interval(axis).min;
+                       });
+    }
+
+    out[node_index].axis = uint8_t(axis);
+
+    if (threads < 2 || span < parallel_task_span) {
+      build_recursive(prims, start, mid, split, depth + 1, 1, out);
+      out[node_index].offset = uint32_t(out.size());
+      build_recursive(prims, mid, end, split, depth + 1, 1, out);
+      return;
+    }
+
+    // The two halves touch disjoint ranges of `prims`, so the second one can
+    // be built into its own node array on another thread and spliced in
+    // afterwards. Each half gets its share of the thread budget.
+    unsigned second_threads = threads / 2;
+    unsigned first_threads = threads - second_threads;
+    std::vector<binary_node> second;
+    auto task = std::async(std::launch::async, [&] {
+      second.reserve(2 * (end - mid));
+      build_recursive(prims, mid, end, split, depth + 1, second_threads,
+                      second);
+    });
+    build_recursive(prims, start, mid, split, depth + 1, first_threads, out);
+    task.get();
 
-      auto mid = start + object_span/2;
-      left = make_shared<bvh_node>(objects, start, mid);
-      right = make_shared<bvh_node>(objects, mid, end);
+    uint32_t base = uint32_t(out.size());
+    out[node_index].offset = base;
+    for (auto& n : second) {
+      if (n.count == 0) n.offset += base;
     }
+    out.insert(out.end(), second.begin(), second.end());
   }
 
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    if (!bbox.hit(r, ray_t)) { return false; }
+  static void make_leaf(binary_node& n, size_t start, size_t span) {
+    n.offset = uint32_t(start);
+    n.count = uint16_t(span);
+  }
 
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right = right->hit(
-      r, 
-      interval(ray_t.min, hit_left ? rec.t : ray_t.max), 
-      rec
-    );
+  // Turns the binary subtree rooted at `index` into wide nodes by repeatedly
+  // opening the interior child with the largest surface area until the node
+  // has `width` children. Returns the index of the new wide node.
+  uint32_t collapse(const std::vector<binary_node>& binary, uint32_t index) {
+    uint32_t wide_index = uint32_t(nodes.size());
+    nodes.emplace_back();
+
+    uint32_t children[width] = {index + 1, binary[index].offset};
+    int child_count = 2;
+    while (child_count < width) {
+      int best = -1;
+      double best_area = -1;
+      for (int i = 0; i < child_count; i++) {
+        const binary_node& c = binary[children[i]];
+        if (c.count == 0 && c.bbox.surface_area() > best_area) {
+          best = i;
+          best_area = c.bbox.surface_area();
+        }
+      }
+      if (best < 0) break;
+
+      uint32_t opened = children[best];
+      children[best] = opened + 1;
+      children[child_count++] = binary[opened].offset;
+    }
 
-    return hit_left || hit_right;
+    clear_slots(nodes[wide_index]);
+    for (int i = 0; i < child_count; i++) {
+      const binary_node& c = binary[children[i]];
+      uint32_t target = c.count > 0 ? c.offset : collapse(binary, children[i]);
+      set_slot(nodes[wide_index], i, c, target);
+    }
+
+    return wide_index;
   }
 
-  aabb bounding_box() const override { return bbox; }
+  static void clear_slots(wide_node& n) {
+    for (int i = 0; i < width; i++) {
+      for (int axis = 0; axis < 3; axis++) {
+        n.bounds[0][axis][i] = std::numeric_limits<float>::infinity();
+        n.bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+      }
+      n.child[i] = empty_slot;
+      n.count[i] = 0;
+    }
+  }
 
- private:
-  shared_ptr<hittable> left;
-  shared_ptr<hittable> right;
-  aabb bbox;
+  // Rounds the double-precision box outwards, with a little slack for the
+  // float rounding of the ray origin, so no hit is ever culled.
+  static void set_slot(wide_node& n, int slot, const binary_node& c,
+                       uint32_t target) {
+    for (int axis = 0; axis < 3; axis++) {
+      const interval& ax = c.bbox.axis_interval(axis);
+      double pad = 0x1p-20 * std::fmax(std::fabs(ax.min), std::fabs(ax.max));
+      n.bounds[0][axis][slot] = round_down(ax.min - pad);
+      n.bounds[1][axis][slot] = round_up(ax.max + pad);
+    }
+    n.child[slot] = target;
+    n.count[slot] = c.count;
+  }
+
+  static float round_down(double x) {
+    float f = float(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity())
+                 : f;
+  }
+
+  static float round_up(double x) {
+    float f = float(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity())
+                 : f;
+  }
+
+  static int lowest_bit(uint32_t bits) {
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int i = 0;
+    while (!(bits & 1)) {
+      bits >>= 1;
+      i++;
+    }
+    return i;
+#endif
+  }
+
+  static int bit_count(uint32_t bits) {
+    int n = 0;
+    for (; bits; bits &= bits - 1) n++;
+    return n;
+  }
+
+  // Slab test of the ray against all children of `n`. Returns a bit mask of
+  // the children that are hit and stores their entry distances in t_near.
+  // NaNs from 0 * inf are ignored, which keeps the test conservative.
+  static int intersect_children(const wide_node& n, const ray_slabs& slabs,
+                                const interval& ray_t, float* t_near) {
+    // Widens the far distance by a few ulps to cover float rounding.
+    const float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+#if defined(__SSE2__)
+    __m128 t_min = _mm_set1_ps(float(ray_t.min));
+    __m128 t_max = _mm_set1_ps(round_up(ray_t.max));
+    for (int axis = 0; axis < 3; axis++) {
+      const __m128 origin = _mm_set1_ps(slabs.origin[axis]);
+      const __m128 inv_dir = _mm_set1_ps(slabs.inv_dir[axis]);
+      const int near_side = slabs.near_side[axis];
+      __m128 t0 = _mm_mul_ps(
+          _mm_sub_ps(_mm_load_ps(n.bounds[near_side][axis]), origin), inv_dir);
+      __m128 t1 = _mm_mul_ps(
+          _mm_sub_ps(_mm_load_ps(n.bounds[1 - near_side][axis]), origin),
+          inv_dir);
+      t_min = _mm_max_ps(t0, t_min);
+      t_max = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(far_scale)), t_max);
+    }
+    _mm_store_ps(t_near, t_min);
+    return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+#else
+    int mask = 0;
+    for (int i = 0; i < width; i++) {
+      float t_min = float(ray_t.min);
+      float t_max = round_up(ray_t.max);
+      for (int axis = 0; axis < 3; axis++) {
+        const int near_side = slabs.near_side[axis];
+        float t0 = (n.bounds[near_side][axis][i] - slabs.origin[axis]) *
+                   slabs.inv_dir[axis];
+        float t1 = (n.bounds[1 - near_side][axis][i] - slabs.origin[axis]) *
+                   slabs.inv_dir[axis] * far_scale;
+        if (t0 > t_min) t_min = t0;
+        if (t1 < t_max) t_max = t1;
+      }
+      t_near[i] = t_min;
+      if (t_min <= t_max) mask |= 1 << i;
+    }
+    return mask;
+#endif
+  }
+
+  // Slab test of every child of `n` against the packet lanes in `lanes`.
+  // child_lanes[i] receives the lanes that hit child i and child_near[i]
+  // their nearest entry distance.
+  static void intersect_packet(const wide_node& n, const packet_slabs& slabs,
+                               uint32_t lanes, uint32_t* child_lanes,
+                               float* child_near) {
+    const float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+    const float inf = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < width; i++) {
+      child_lanes[i] = 0;
+      child_near[i] = inf;
+    }
+
+#if defined(__SSE2__)
+    static_assert(ray_packet::size % 4 == 0, "lanes are tested four at a time");
+    const __m128 scale = _mm_set1_ps(far_scale);
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    for (int g = 0; g < ray_packet::size; g += 4) {
+      const int group = (lanes >> g) & 0xf;
+      if (!group) continue;
+      const __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(
+          _mm_and_si128(_mm_set1_epi32(group), lane_bits), lane_bits));
+
+      __m128 origin[3], inv_dir[3];
+      for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = _mm_load_ps(slabs.origin[axis] + g);
+        inv_dir[axis] = _mm_load_ps(slabs.inv_dir[axis] + g);
+      }
+      const __m128 far_init = _mm_load_ps(slabs.t_far + g);
+
+      for (int i = 0; i < width; i++) {
+        if (n.child[i] == empty_slot) continue;
+        __m128 t_min = _mm_set1_ps(slabs.t_min);
+        __m128 t_max = far_init;
+        for (int axis = 0; axis < 3; axis++) {
+          const __m128 lo = _mm_set1_ps(n.bounds[0][axis][i]);
+          const __m128 hi = _mm_set1_ps(n.bounds[1][axis][i]);
+          __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, origin[axis]), inv_dir[axis]);
+          __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, origin[axis]), inv_dir[axis]);
+          t_min = _mm_max_ps(_mm_min_ps(t0, t1), t_min);
+          t_max = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t0, t1), scale), t_max);
+        }
+        const __m128 hit = _mm_and_ps(_mm_cmple_ps(t_min, t_max), active);
+        const int mask = _mm_movemask_ps(hit);
+        if (!mask) continue;
+
+        alignas(16) float t_near[4];
+        _mm_store_ps(t_near, t_min);
+        child_lanes[i] |= uint32_t(mask) << g;
+        for (int k = 0; k < 4; k++) {
+          if ((mask >> k) & 1)
+            child_near[i] = std::fmin(child_near[i], t_near[k]);
+        }
+      }
+    }
+#else
+    for (uint32_t rest = lanes; rest; rest &= rest - 1) {
+      const int lane = lowest_bit(rest);
+      for (int i = 0; i < width; i++) {
+        if (n.child[i] == empty_slot) continue;
+        float t_min = slabs.t_min;
+        float t_max = slabs.t_far[lane];
+        for (int axis = 0; axis < 3; axis++) {
+          const float origin = slabs.origin[axis][lane];
+          const float inv_dir = slabs.inv_dir[axis][lane];
+          float t0 = (n.bounds[0][axis][i] - origin) * inv_dir;
+          float t1 = (n.bounds[1][axis][i] - origin) * inv_dir;
+          t_min = std::fmax(std::fmin(t0, t1), t_min);
+          t_max = std::fmin(std::fmax(t0, t1) * far_scale, t_max);
+        }
+        if (t_min <= t_max) {
+          child_lanes[i] |= 1u << lane;
+          child_near[i] = std::fmin(child_near[i], t_min);
+        }
+      }
+    }
+#endif
+  }
 
-  static bool box_compare(
-    const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
-  ) {
-    auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-    auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-    return a_axis_interval.min < b_axis_interval.min;
+  static void compute_bounds(const std::vector<build_primitive>& prims,
+                             size_t start, size_t end, unsigned threads,
+                             aabb& bbox, aabb& centroid_bounds) {
+    std::mutex merge;
+    bbox = centroid_bounds = aabb::empty;
+    parallel_for(start, end, parallel_grain, threads, [&](size_t b, size_t e) {
+      aabb box = aabb::empty, cbox = aabb::empty;
+      for (size_t i = b; i < e; i++) {
+        box = aabb(box, prims[i].bounds);
+        cbox = aabb(cbox, aabb(prims[i].centroid, prims[i].centroid));
+      }
+      std::lock_guard<std::mutex> lock(merge);
+      bbox = aabb(bbox, box);
+      centroid_bounds = aabb(centroid_bounds, cbox);
+    });
   }
 
-  static bool box_x_compare(
-    const shared_ptr<hittable> a,
-    const shared_ptr<hittable> b)
-  {
-    return box_compare(a, b, 0);
+  // Returns the axis of the cheapest split plane, or -1 when no plane
+  // separates the centroids. Costs are relative to intersecting one
+  // primitive, so a leaf with n primitives costs n.
+  static int find_sah_split(const std::vector<build_primitive>& prims,
+                            size_t start, size_t end, unsigned threads,
+                            const aabb& bbox, const aabb& centroid_bounds,
+                            double& best_cost, int& best_split) {
+    int best_axis = -1;
+    best_split = 0;
+    best_cost = infinity;
+    double parent_area = bbox.surface_area();
+
+    for (int axis = 0; axis < 3 && end - start > 1; axis++) {
+      const interval& extent = centroid_bounds.axis_interval(axis);
+      if (extent.size() <= 0) continue;
+
+      sah_bin bins[sah_bins];
+      std::mutex merge;
+      parallel_for(start, end, parallel_grain, threads,
+                   [&](size_t b, size_t e) {
+        sah_bin local[sah_bins];
+        for (size_t i = b; i < e; i++) {
+          auto& bin = local[bin_index(prims[i].centroid[axis], extent)];
+          bin.bounds = aabb(bin.bounds, prims[i].bounds);
+          bin.count++;
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        for (int i = 0; i < sah_bins; i++) {
+          bins[i].bounds = aabb(bins[i].bounds, local[i].bounds);
+          bins[i].count += local[i].count;
+        }
+      });
+
+      // Sweep from the right to get the area and count of every suffix, then
+      // from the left to evaluate each of the sah_bins - 1 split planes.
+      double right_area[sah_bins];
+      size_t right_count[sah_bins];
+      aabb acc = aabb::empty;
+      size_t count = 0;
+      for (int i = sah_bins - 1; i > 0; i--) {
+        acc = aabb(acc, bins[i].bounds);
+        count += bins[i].count;
+        right_area[i] = count ? acc.surface_area() : 0.0;
+        right_count[i] = count;
+      }
+
+      acc = aabb::empty;
+      count = 0;
+      for (int i = 0; i < sah_bins - 1; i++) {
+        acc = aabb(acc, bins[i].bounds);
+        count += bins[i].count;
+        if (count == 0 || right_count[i + 1] == 0) continue;
+
+        double cost = traversal_cost +
+                      (acc.surface_area() * count +
+                       right_area[i + 1] * right_count[i + 1]) / parent_area;
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = i;
+        }
+      }
+    }
+
+    return best_axis;
   }
 
-  static bool box_y_compare(
-    const shared_ptr<hittable> a,
-    const shared_ptr<hittable> b)
-  {
-    return box_compare(a, b, 1);
+  static int bin_index(double c, const interval& extent) {
+    int b = int(sah_bins * (c - extent.min) / extent.size());
+    return std::clamp(b, 0, sah_bins - 1);
   }
+};
+
+class bvh_node : public hittable {
+ public:
+  // Spheres, quads, triangles and media are copied into the node, see
+  // primitive_store. Pass the list in with std::move to free the originals
+  // that nothing else holds.
+  bvh_node(hittable_list list, bvh_split split = bvh_split::sah) {
+    auto& objects = list.objects;
+    auto build_start = std::chrono::steady_clock::now();
+
+    std::vector<aabb> bounds(objects.size());
+    parallel_for(0, objects.size(), 1 << 14, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        bounds[i] = objects[i]->bounding_box();
+      }
+    });
 
-  static bool box_z_compare(
-    const shared_ptr<hittable> a,
-    const shared_ptr<hittable> b)
-  {
-    return box_compare(a, b, 2);
+    tree.build(bounds, split);
+    bbox = tree.bounds();
+
+    // Leaves address `refs` in tree order, and each typed array in the store
+    // is filled in that same order.
+    refs.reserve(objects.size());
+    for (auto index : tree.primitive_order()) {
+      refs.push_back(store.add(std::move(objects[index])));
+    }
+
+    auto build_end = std::chrono::steady_clock::now();
+    build_ms =
+        std::chrono::duration<double, std::milli>(build_end - build_start)
+            .count();
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    return tree.hit(r, ray_t, [&](uint32_t i, interval& t) {
+      if (!store.hit(refs[i], r, t, rec)) return false;
+      t.max = rec.t;
+      return true;
+    });
+  }
+
+  void hit_packet(ray_packet& packet, hit_record* recs) const override {
+    tree.hit_packet(packet, [&](uint32_t i, int lane, interval& t) {
+      if (!store.hit(refs[i], packet.rays[lane], t, recs[lane])) return false;
+      t.max = recs[lane].t;
+      return true;
+    });
   }
 
+  aabb bounding_box() const override { return bbox; }
+
+  // Wall-clock construction time, reported separately from render time.
+  double build_time_ms() const { return build_ms; }
+
+  size_t object_count() const { return refs.size(); }
+  size_t node_count() const { return tree.node_count(); }
+
+ private:
+  bvh_tree tree;
+  primitive_store store;
+  std::vector<primitive_store::ref> refs;
+  aabb bbox;
+  double build_ms = 0;
 };
@@ -4,93 +4,340 @@
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "stb_image_write.h"
 
+#include "checkpoint.h"
+#include "denoiser.h"
 #include "hittable.h"
+#include "hittable_list.h"
 #include "material.h"
+#include "parallel.h"
+#include "tile_scheduler.h"
 
 class camera {
  public:
-  double aspect_ratio      = 1.0;
+  real   aspect_ratio      = 1.0;
   int    image_width       = 100;
   int    samples_per_pixel = 10;
   int    max_depth         = 10;
   color  background;
 
-  double       vfov     = 90;
+  real         vfov     = 90;
   point3       lookfrom = point3(0.0, 0.0, 0.0);
   point3       lookat   = point3(0.0, 0.0, -1.0);
-  vec3<double> vup      = vec3<double>(0.0, 1.0, 0.0);
+  vec3<real>   vup      = vec3<real>(0.0, 1.0, 0.0);
 
-  double defocus_angle = 0;
-  double focus_dist    = 0;
+  real defocus_angle = 0;
+  real focus_dist    = 0;
+
+  int russian_roulette_depth = 3;  // Bounces before paths may be terminated
+
+  int num_threads = 0;   // Worker threads, 0 uses every hardware thread
+  int tile_size   = 16;  // Edge length of the square tiles handed to workers
+
+  // Adaptive sampling: once a pixel has min_samples_per_pixel samples it
+  // stops as soon as the 95% confidence interval of its luminance is within
+  // adaptive_threshold of the mean. samples_per_pixel stays the upper bound.
+  // 0 disables it and every pixel gets samples_per_pixel samples.
+  double adaptive_threshold    = 0;
+  int    min_samples_per_pixel = 16;
+  bool   write_sample_map      = false;  // Writes <name>-spp.hdr
+
+  // Traces camera rays in packets of ray_packet::size neighbouring pixels,
+  // one stratum at a time, so each BVH node is fetched once for the whole
+  // packet. Bounces after the first hit are traced one ray at a time.
+  // Ignored in adaptive mode, where pixels stop after different counts.
+  bool packet_primary_rays = false;
+
+  // Where the sample values come from, see sampler_type. Low-discrepancy
+  // samplers drive every random decision of a path, not only the pixel
+  // offset.
+  sampler_type sampler = sampler_type::stratified;
+
+  // Every random decision of a pixel sample is drawn from a stream keyed by
+  // the seed, the pixel and the sample index, so a given seed renders the
+  // same image bit for bit whatever the thread count, tile size or tile
+  // order. Negative picks a new seed for every render.
+  int64_t seed = -1;
+
+  // With a checkpoint_path the samples of every pixel are saved there every
+  // checkpoint_interval seconds (0 only at the end) and when the render
+  // ends. With resume the render continues from that file if it exists,
+  // with its seed; raising samples_per_pixel adds only the missing samples.
+  std::string checkpoint_path;
+  double      checkpoint_interval = 300;
+  bool        resume              = false;
+
+  // Names the scene and whatever decides its layout, so resuming a
+  // checkpoint of another scene is refused even when the camera and scene
+  // bounds happen to match.
+  std::string scene_id;
+
+  // Progressive mode renders the whole frame in passes of 1, 2, 4, ...
+  // samples per pixel up to samples_per_pixel. A background thread writes
+  // the image so far to <name>-preview.png after the first pass, then every
+  // snapshot_interval seconds (0 disables those) and at the end. Strata are
+  // visited in an order that spreads every pass over the whole pixel.
+  bool   progressive       = false;
+  double snapshot_interval = 10;
+
+  // Also writes <name>-denoised.hdr, filtered with the first-hit albedo,
+  // normal and depth of every pixel as guides, see denoiser.
+  bool denoise = false;
+
+  // Also writes <name>-heatmap-nodes.png and <name>-heatmap-tests.png, the
+  // BVH nodes visited and primitives tested per camera ray in false colour,
+  // or per path including shadow rays with heatmap_paths. Needs a build
+  // with RAYTRACER_STATS.
+  bool write_heatmap = false;
+  bool heatmap_paths = false;
+
+  bool quiet = false;  // Keeps render() from printing progress and statistics
+
+  // Results of the last render(). `image` is the gamma-encoded RGB that
+  // was written, or the denoised one when denoise is set. `stats` stays
+  // zero unless built with RAYTRACER_STATS, and is then also written to
+  // <name>-stats.json.
+  double             render_seconds = 0;
+  uint64_t           rays_traced    = 0;
+  std::vector<float> image;
+  render_stats       stats;
 
   int idx(int i, int j) const { return j * image_width + i; }
 
-  void render(const hittable& world, std::string filename) {
+  // Emitters in `lights` are sampled directly at every non-specular vertex
+  // and combined with BSDF sampling by multiple importance sampling. They
+  // must also be part of `world`; an empty list disables light sampling.
+  void render(const hittable& world, const hittable_list& lights,
+              std::string filename) {
     initialize();
 
+    render_checkpoint state;
+    if (!start_state(state, world, lights)) return;
+
     std::vector<float> raster(image_height * image_width * 3);
-    std::atomic<int> rows_done = 0;
-    const unsigned hw = std::thread::hardware_concurrency();
-    const unsigned num_threads = hw ? hw : 1;
+    std::vector<int> sample_counts(image_height * image_width, 0);
+    std::atomic<size_t> tiles_done = 0;
+    std::atomic<uint64_t> total_rays = 0;
+    const unsigned workers =
+        num_threads > 0 ? unsigned(num_threads) : hardware_threads();
+
+    tile_scheduler scheduler(image_width, image_height, tile_size);
+    const auto& pixel_order = scheduler.pixel_order();
+    const bool use_packets = packet_primary_rays && adaptive_threshold <= 0;
+    std::vector<double> busy_seconds(workers, 0.0);
+
+    const int max_samples = sqrt_spp * sqrt_spp;
+    std::vector<int> passes;
+    if (progressive) {
+      for (int n = 1; n < max_samples; n *= 2) passes.push_back(n);
+    }
+    passes.push_back(max_samples);
 
+    stats = render_stats();
     auto start_time = std::chrono::steady_clock::now();
 
-    auto worker = [&](int y0, int y1) {
-      for (int j = y0; j < y1; ++j) {
-        for (int i = 0; i < image_width; ++i) {
-          color pixel_color(0.0, 0.0, 0.0);
-          for (int s_j = 0; s_j < sqrt_spp; ++s_j) {
-            for (int s_i = 0; s_i < sqrt_spp; ++s_i) {
-              ray r = get_ray(i, j, s_i, s_j);
-              pixel_color += ray_color(r, max_depth, world);
+    // Tiles are rendered into a copy of their accumulators and committed
+    // whole, so a checkpoint or preview never holds a partly updated pixel.
+    // Periodic checkpoints copy the accumulators under commit_mutex and
+    // write the copy outside it, one at a time.
+    std::mutex commit_mutex;
+    auto last_checkpoint = start_time;
+    bool checkpoint_writing = false;
+
+    for (size_t p = 0; p < state.pixels.size(); p++) {
+      store_pixel(state.pixels[p], &raster[3 * p], sample_counts[p]);
+    }
+
+    // The preview thread holds commit_mutex only to copy the raster, and
+    // converts and writes the copy while the workers carry on.
+    const std::string preview_filename =
+        with_extension(with_suffix(filename, "-preview"), ".png");
+    std::mutex preview_mutex;
+    std::condition_variable preview_wake;
+    bool preview_requested = false;
+    bool preview_done = false;
+    bool first_pass_done = false;  // No preview until the 1 spp pass is in
+    auto write_preview = [&] {
+      std::vector<float> copy;
+      {
+        std::lock_guard<std::mutex> lock(commit_mutex);
+        copy = raster;
+      }
+      write_png(preview_filename, copy);
+    };
+    auto preview_loop = [&] {
+      std::unique_lock<std::mutex> lock(preview_mutex);
+      while (!preview_done) {
+        auto woken = [&] { return preview_done || preview_requested; };
+        if (snapshot_interval > 0) {
+          preview_wake.wait_for(
+              lock, std::chrono::duration<double>(snapshot_interval), woken);
+        } else {
+          preview_wake.wait(lock, woken);
+        }
+        if (preview_done) break;
+        if (!first_pass_done) continue;
+        preview_requested = false;
+        lock.unlock();
+        write_preview();
+        lock.lock();
+      }
+    };
+    auto notify_preview = [&](bool done) {
+      {
+        std::lock_guard<std::mutex> lock(preview_mutex);
+        (done ? preview_done : preview_requested) = true;
+        first_pass_done = true;
+      }
+      preview_wake.notify_one();
+    };
+    std::thread preview_thread;
+    if (progressive) preview_thread = std::thread(preview_loop);
+
+    for (size_t pass = 0; pass < passes.size(); pass++) {
+      const int pass_samples = passes[pass];
+      tiles_done = 0;
+      scheduler.reset();
+
+      auto worker = [&](unsigned id) {
+        uint64_t rays = 0;
+        std::vector<pixel_accumulator> local;
+        tile t;
+        while (scheduler.next(t)) {
+          auto tile_start = std::chrono::steady_clock::now();
+
+          const int tile_width = t.x1 - t.x0;
+          local.resize(size_t(tile_width) * (t.y1 - t.y0));
+          for (int j = t.y0; j < t.y1; j++) {
+            std::copy_n(&state.pixels[idx(t.x0, j)], tile_width,
+                        &local[(j - t.y0) * tile_width]);
+          }
+          auto pixel = [&](int i, int j) -> pixel_accumulator& {
+            return local[(j - t.y0) * tile_width + (i - t.x0)];
+          };
+
+          if (use_packets) {
+            render_tile_packets(t, world, lights, rays, pass_samples, pixel);
+          } else {
+            for (const auto& offset : pixel_order) {
+              const int i = t.x0 + offset.x;
+              const int j = t.y0 + offset.y;
+              if (i >= t.x1 || j >= t.y1) continue;
+
+              render_pixel(i, j, world, lights, rays, pass_samples,
+                           pixel(i, j));
+            }
+          }
+
+          render_checkpoint snapshot;
+          bool save_checkpoint = false;
+          {
+            std::lock_guard<std::mutex> lock(commit_mutex);
+            for (int j = t.y0; j < t.y1; j++) {
+              for (int i = t.x0; i < t.x1; i++) {
+                const int p = idx(i, j);
+                state.pixels[p] = pixel(i, j);
+                store_pixel(state.pixels[p], &raster[3 * p], sample_counts[p]);
+              }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (!checkpoint_path.empty() && checkpoint_interval > 0 &&
+                !checkpoint_writing &&
+                std::chrono::duration<double>(now - last_checkpoint).count() >=
+                    checkpoint_interval) {
+              snapshot = state;
+              last_checkpoint = now;
+              checkpoint_writing = save_checkpoint = true;
             }
           }
+          if (save_checkpoint) {
+            snapshot.write(checkpoint_path);
+            std::lock_guard<std::mutex> lock(commit_mutex);
+            checkpoint_writing = false;
+          }
 
-          const color sample_color = pixel_sample_scale * pixel_color;
+          busy_seconds[id] += std::chrono::duration<double>(
+              std::chrono::steady_clock::now() - tile_start).count();
 
-          const int base = 3 * idx(i, j);
-          raster[base + 0] = linear_to_gama(std::max(0.0, sample_color.x()));
-          raster[base + 1] = linear_to_gama(std::max(0.0, sample_color.y()));
-          raster[base + 2] = linear_to_gama(std::max(0.0, sample_color.z()));
+          size_t done = ++tiles_done;
+          if (!quiet && done % 10 == 0) {
+            double pct = 100.0 * done / scheduler.tile_count();
+            out() << "\rRendering: ";
+            if (progressive) {
+              out() << "pass " << pass + 1 << "/" << passes.size() << " ("
+                    << pass_samples << " spp), ";
+            }
+            out() << std::fixed << std::setprecision(1) << pct
+                  << "% completed" << std::flush;
+          }
         }
-        int done = ++rows_done;
-        if (done % 10 == 0) {
-          double pct = 100.0 * done / image_height;
-          std::cout << "\rRendering: " << std::fixed << std::setprecision(1)
-                    << pct << "% completed" << std::flush;
+        total_rays += rays;
+        if (render_stats_enabled) {
+          std::lock_guard<std::mutex> lock(commit_mutex);
+          stats.add(thread_stats());
+          thread_stats() = render_stats();
         }
-      }
-    };
+      };
 
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-    int row_per_thread = (image_height + static_cast<int>(num_threads) - 1) /
-                         static_cast<int>(num_threads);
+      std::vector<std::thread> threads;
+      threads.reserve(workers);
+      for (unsigned t = 0; t < workers; ++t) {
+        threads.emplace_back(worker, t);
+      }
 
-    int y0 = 0;
-    for (unsigned t = 0; t < num_threads; ++t) {
-      int y1 = std::min(image_height, y0 + row_per_thread);
-      if (y0 >= y1) break;
-      threads.emplace_back(worker, y0, y1);
-      y0 = y1;
-    }
+      for (auto& th : threads) {
+        th.join();
+      }
 
-    for (auto& th : threads) {
-      th.join();
+      if (progressive && pass == 0) notify_preview(false);
     }
 
     auto end_time = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    double wall_seconds =
+        std::chrono::duration<double>(end_time - start_time).count();
+
+    if (progressive) {
+      notify_preview(true);
+      preview_thread.join();
+      write_preview();
+    }
 
-    const int write_result = stbi_write_hdr(
+    const bool saved_checkpoint =
+        !checkpoint_path.empty() && state.write(checkpoint_path);
+
+    std::string denoised_filename;
+    double denoise_seconds = 0;
+    if (denoise) {
+      auto denoise_start = std::chrono::steady_clock::now();
+      if (!filename.empty()) {
+        denoised_filename = with_suffix(filename, "-denoised");
+      }
+      image = write_denoised(state, world, workers, denoised_filename);
+      denoise_seconds = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - denoise_start).count();
+    } else {
+      image = raster;
+    }
+
+    render_seconds = wall_seconds;
+    rays_traced = total_rays;
+
+    // An empty filename renders without writing the image.
+    const int write_result = filename.empty() ? 1 : stbi_write_hdr(
       filename.c_str(),
       image_width,
       image_height,
@@ -102,6 +349,9 @@ class camera {
       std::cerr << "\nERROR: Failed to write HDR image: " << filename << "\n";
     }
 
+    double mrays_per_sec =
+        duration > 0 ? total_rays / (duration * 1000.0) : 0.0;
+
     int hours = static_cast<int>(duration / 3600000);
     duration %= 3600000;
     int minutes = static_cast<int>(duration / 60000);
@@ -110,13 +360,61 @@ class camera {
     int milliseconds = static_cast<int>(duration % 1000);
 
 
-    std::cout << "\nDone in "
-              << std::setfill('0') << std::setw(2) << hours << ":"
-              << std::setw(2) << minutes << ":"
-              << std::setw(2) << seconds << ":"
-              << std::setw(3) << milliseconds << "\n";
+    out() << "\nDone in "
+          << std::setfill('0') << std::setw(2) << hours << ":"
+          << std::setw(2) << minutes << ":"
+          << std::setw(2) << seconds << ":"
+          << std::setw(3) << milliseconds << "\n";
 
-    std::cout << "Render path: " << filename << std::endl;
+    out() << "Rays: " << total_rays << " (" << std::fixed
+          << std::setprecision(2) << mrays_per_sec << " Mrays/s)\n";
+
+    report_idle_time(busy_seconds, wall_seconds, scheduler.tile_count());
+
+    std::string stats_filename;
+    if (render_stats_enabled) {
+      stats.print(out());
+      if (!filename.empty()) {
+        stats_filename = with_extension(with_suffix(filename, "-stats"),
+                                        ".json");
+        if (!stats.write_json(stats_filename)) stats_filename.clear();
+      }
+    }
+
+    out() << "Seed: " << render_seed << ", image hash: " << std::hex
+          << std::setw(16) << std::setfill('0') << image_hash(raster)
+          << std::dec << std::setfill(' ') << "\n";
+
+    if (adaptive_threshold > 0) {
+      report_sample_counts(sample_counts, filename);
+    }
+
+    if (saved_checkpoint) {
+      out() << "Checkpoint: " << checkpoint_path << "\n";
+    }
+
+    if (progressive) {
+      out() << "Preview: " << preview_filename << "\n";
+    }
+
+    if (!stats_filename.empty()) {
+      out() << "Stats: " << stats_filename << "\n";
+    }
+
+    if (denoise) {
+      out() << "Denoised in " << std::setprecision(2) << denoise_seconds
+            << " s: " << denoised_filename << "\n";
+    }
+
+    if (write_heatmap && !filename.empty()) {
+      write_heatmaps(world, lights, workers, filename);
+    }
+
+    out() << "Render path: " << filename << std::endl;
+  }
+
+  void render(const hittable& world, std::string filename) {
+    render(world, hittable_list(), filename);
   }
 
   void render(const hittable& world) {
@@ -124,19 +422,33 @@ class camera {
   }
 
  private:
+  static const int adaptive_batch = 8;
+  static const int min_contributing_samples = 8;
+  static const int packet_width = 4;
+  static const int packet_height = 2;
+
   int          image_height;
-  double       pixel_sample_scale;
   int          sqrt_spp;
-  double       recip_sqrt_spp;
+  int          grid_size;
+  real         recip_grid_size;
+  int          stratum_stride;
+  uint64_t     render_seed;
   point3       center;
   point3       pixel00_loc;
-  vec3<double> pixel_delta_u;
-  vec3<double> pixel_delta_v;
-  vec3<double> u, v, w;
-  vec3<double> defocus_disk_u;
-  vec3<double> defocus_disk_v;
+  vec3<real>   pixel_delta_u;
+  vec3<real>   pixel_delta_v;
+  vec3<real>   u, v, w;
+  vec3<real>   defocus_disk_u;
+  vec3<real>   defocus_disk_v;
 
   void initialize() {
+    if (seed >= 0) {
+      render_seed = uint64_t(seed);
+    } else {
+      std::random_device rd;
+      render_seed = ((uint64_t(rd()) << 32) ^ rd()) >> 1;
+    }
+
     if (focus_dist <= 0) {
       focus_dist = (lookfrom - lookat).length();
     }
@@ -145,8 +457,16 @@ class camera {
     image_height = (image_height < 1) ? 1 : image_height;
 
     sqrt_spp = int(std::sqrt(samples_per_pixel));
-    pixel_sample_scale = 1.0 / (sqrt_spp * sqrt_spp);
-    recip_sqrt_spp = 1.0 / sqrt_spp;
+
+    // A stride coprime to the stratum count near the golden ratio visits
+    // every stratum once while spreading any prefix over the whole pixel.
+    const int strata = sqrt_spp * sqrt_spp;
+    int stride = 1;
+    if ((adaptive_threshold > 0 || progressive) && strata > 2) {
+      stride = int(0.618 * strata);
+      while (std::gcd(stride, strata) != 1) stride++;
+    }
+    stratify(sqrt_spp, stride);
 
     center = lookfrom;
 
@@ -154,7 +474,7 @@ class camera {
     auto h = std::tan(theta / 2);
     auto viewport_height = 2 * h * focus_dist;
     auto viewport_width =
-        viewport_height * (double(image_width) / image_height);
+        viewport_height * (real(image_width) / image_height);
 
     w = unit_vector(lookfrom - lookat);
     u = unit_vector(cross(vup, w));
@@ -175,8 +495,532 @@ class camera {
     defocus_disk_v = v * defocus_radius;
   }
 
-  ray get_ray(int i, int j, int s_i, int s_j) const {
-    auto offset = sample_square_stratified(s_i, s_j);
+  // Stratifies the first grid^2 samples of a pixel over a grid x grid
+  // grid, visiting the strata in steps of `stride`.
+  void stratify(int grid, int stride) {
+    grid_size = grid;
+    recip_grid_size = 1.0 / grid_size;
+    stratum_stride = stride;
+  }
+
+  // Fills `state` with empty accumulators or, when resuming, with the
+  // checkpoint, whose seed and stratification then replace this render's.
+  // Returns false if the checkpoint is unreadable or belongs to another
+  // render.
+  bool start_state(render_checkpoint& state, const hittable& world,
+                   const hittable_list& lights) {
+    const uint64_t hash = scene_hash(world, lights);
+
+    if (!resume || !render_checkpoint::exists(checkpoint_path)) {
+      state.width = uint32_t(image_width);
+      state.height = uint32_t(image_height);
+      state.grid = uint32_t(grid_size);
+      state.stride = uint32_t(stratum_stride);
+      state.sampler = uint32_t(sampler);
+      state.seed = render_seed;
+      state.scene_hash = hash;
+      state.pixels.assign(size_t(image_width) * image_height,
+                          pixel_accumulator());
+      return true;
+    }
+
+    if (!state.read(checkpoint_path)) return false;
+
+    if (state.width != uint32_t(image_width) ||
+        state.height != uint32_t(image_height) || state.scene_hash != hash) {
+      std::cerr << "ERROR: Checkpoint " << checkpoint_path
+                << " belongs to a different scene or camera\n";
+      return false;
+    }
+    if (state.sampler != uint32_t(sampler) ||
+        (seed >= 0 && state.seed != uint64_t(seed))) {
+      std::cerr << "ERROR: Checkpoint " << checkpoint_path
+                << " was rendered with a different sampler or seed\n";
+      return false;
+    }
+
+    render_seed = state.seed;
+    stratify(int(state.grid), int(state.stride));
+
+    double samples = 0;
+    for (const auto& px : state.pixels) samples += px.count;
+    out() << "Resuming " << checkpoint_path << " at " << std::fixed
+          << std::setprecision(1) << samples / state.pixels.size()
+          << " spp on average\n";
+    return true;
+  }
+
+  // FNV-1a over what decides the image apart from the sampling: the camera,
+  // the scene_id and, as a cheap fingerprint of the scene, its bounds and
+  // light count.
+  uint64_t scene_hash(const hittable& world, const hittable_list& lights) const {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto add = [&](const auto& value) {
+      const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+      for (size_t k = 0; k < sizeof(value); k++) {
+        hash = (hash ^ bytes[k]) * 0x100000001b3ULL;
+      }
+    };
+
+    const aabb box = world.bounding_box();
+    const real values[] = {
+        aspect_ratio,  vfov,          lookfrom.x(),  lookfrom.y(),
+        lookfrom.z(),  lookat.x(),    lookat.y(),    lookat.z(),
+        vup.x(),       vup.y(),       vup.z(),       defocus_angle,
+        focus_dist,    background.x(), background.y(), background.z(),
+        box.x.min,     box.x.max,     box.y.min,     box.y.max,
+        box.z.min,     box.z.max};
+    for (real value : values) add(value);
+    add(image_width);
+    add(max_depth);
+    add(russian_roulette_depth);
+    add(lights.objects.size());
+    for (char c : scene_id) add(c);
+    return hash;
+  }
+
+  // Time each worker spent outside of tiles: waiting to start, and waiting
+  // for the others after the tile queue ran dry.
+  void report_idle_time(const std::vector<double>& busy_seconds,
+                        double wall_seconds, size_t tiles) const {
+    out() << "Threads: " << busy_seconds.size() << ", tiles: " << tiles
+          << "\n";
+    for (size_t t = 0; t < busy_seconds.size(); t++) {
+      double idle = std::max(0.0, wall_seconds - busy_seconds[t]);
+      out() << "  thread " << t << ": busy " << std::setprecision(2)
+            << busy_seconds[t] << " s, idle " << idle << " s ("
+            << std::setprecision(1)
+            << (wall_seconds > 0 ? 100.0 * idle / wall_seconds : 0.0)
+            << "%)\n";
+    }
+  }
+
+  void report_sample_counts(const std::vector<int>& sample_counts,
+                            const std::string& filename) const {
+    const int max_spp = sqrt_spp * sqrt_spp;
+    double total = 0;
+    std::vector<float> map(3 * sample_counts.size());
+    for (size_t p = 0; p < sample_counts.size(); p++) {
+      total += sample_counts[p];
+      map[3 * p + 0] = map[3 * p + 1] = map[3 * p + 2] =
+          float(sample_counts[p]) / max_spp;
+    }
+
+    double average = total / sample_counts.size();
+    out() << "Adaptive sampling: " << std::setprecision(1) << average
+          << " spp on average (" << 100.0 * average / max_spp
+          << "% of " << max_spp << ")\n";
+
+    if (!write_sample_map || filename.empty()) return;
+
+    auto map_filename = with_suffix(filename, "-spp");
+    if (stbi_write_hdr(map_filename.c_str(), image_width, image_height, 3,
+                       map.data()) == 0) {
+      std::cerr << "ERROR: Failed to write sample map: " << map_filename
+                << "\n";
+    } else {
+      out() << "Sample map: " << map_filename << "\n";
+    }
+  }
+
+  // Inserts `suffix` in front of the extension of `filename`.
+  static std::string with_suffix(const std::string& filename,
+                                 const std::string& suffix) {
+    auto dot = extension_start(filename);
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+  }
+
+  // Replaces the extension of `filename` with `extension`.
+  static std::string with_extension(const std::string& filename,
+                                    const std::string& extension) {
+    return filename.substr(0, extension_start(filename)) + extension;
+  }
+
+  static size_t extension_start(const std::string& filename) {
+    auto dot = filename.rfind('.');
+    auto slash = filename.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      return filename.size();
+    return dot;
+  }
+
+  // Stream render() reports to; discards everything when quiet.
+  std::ostream& out() const {
+    static std::ostream discard(nullptr);
+    return quiet ? discard : std::cout;
+  }
+
+  // Writes the gamma-encoded mean of `px` to `rgb` and its sample count to
+  // `sample_count`.
+  static void store_pixel(const pixel_accumulator& px, float* rgb,
+                          int& sample_count) {
+    color pixel_color(0.0, 0.0, 0.0);
+    if (px.count > 0) {
+      pixel_color = color(px.sum[0], px.sum[1], px.sum[2]) / px.count;
+    }
+    rgb[0] = linear_to_gama(std::max<real>(0, pixel_color.x()));
+    rgb[1] = linear_to_gama(std::max<real>(0, pixel_color.y()));
+    rgb[2] = linear_to_gama(std::max<real>(0, pixel_color.z()));
+    sample_count = int(px.count);
+  }
+
+  // Filters the accumulated radiance and writes it, gamma-encoded, to
+  // `filename` unless that is empty. Returns the gamma-encoded image.
+  std::vector<float> write_denoised(const render_checkpoint& state,
+                                    const hittable& world, unsigned threads,
+                                    const std::string& filename) const {
+    const size_t count = state.pixels.size();
+    std::vector<float> radiance(3 * count), variance(count);
+    for (size_t p = 0; p < count; p++) {
+      const auto& px = state.pixels[p];
+      const double n = px.count;
+      for (int c = 0; c < 3; c++) {
+        radiance[3 * p + c] = n > 0 ? float(px.sum[c] / n) : 0.0f;
+      }
+      // A single sample says nothing about the noise; treat it as large.
+      variance[p] = n > 1 ? float(px.luminance_m2 / (n - 1) / n) : 1e3f;
+    }
+
+    auto filtered = denoiser().filter(image_width, image_height, radiance,
+                                      variance, collect_features(world, threads),
+                                      threads);
+    for (auto& value : filtered) {
+      value = linear_to_gama(std::max(0.0f, value));
+    }
+
+    if (!filename.empty() &&
+        stbi_write_hdr(filename.c_str(), image_width, image_height, 3,
+                       filtered.data()) == 0) {
+      std::cerr << "\nERROR: Failed to write HDR image: " << filename << "\n";
+    }
+    return filtered;
+  }
+
+  // First-hit albedo, normal and depth of every pixel, from a 2x2 grid of
+  // camera rays. The albedo is the attenuation of the first scattering
+  // event, which for textured materials is the texture colour.
+  feature_buffers collect_features(const hittable& world,
+                                   unsigned threads) const {
+    const int grid = 2;
+    const size_t count = size_t(image_width) * image_height;
+    feature_buffers features;
+    features.albedo.assign(3 * count, 0.0f);
+    features.normal.assign(3 * count, 0.0f);
+    features.depth.assign(count, 0.0f);
+
+    parallel_for(0, size_t(image_height), 8, threads,
+                 [&](size_t j0, size_t j1) {
+      for (int j = int(j0); j < int(j1); j++) {
+        for (int i = 0; i < image_width; i++) {
+          const size_t p = size_t(idx(i, j));
+          const uint64_t pixel = (uint64_t(uint32_t(i)) << 32) | uint32_t(j);
+          thread_rng().seed(mix_bits(render_seed ^ mix_bits(pixel)),
+                            ~uint64_t(0));
+
+          color albedo(0.0, 0.0, 0.0);
+          vec3<real> normal(0.0, 0.0, 0.0);
+          real depth = 0;
+          for (int s = 0; s < grid * grid; s++) {
+            const vec3<real> offset((s % grid + 0.5) / grid - 0.5,
+                                    (s / grid + 0.5) / grid - 0.5, 0);
+            const ray r = camera_ray(i, j, offset);
+            hit_record rec;
+            ray scattered;
+            color attenuation(1.0, 1.0, 1.0);
+            if (world.hit(r, interval(0.001, infinity), rec)) {
+              if (!rec.mat->scatter(r, rec, attenuation, scattered)) {
+                attenuation = color(1.0, 1.0, 1.0);
+              }
+              normal += rec.normal;
+              depth += rec.t * r.direction().length();
+            }
+            albedo += attenuation;
+          }
+
+          albedo /= grid * grid;
+          if (normal.length_squared() > 0) normal = unit_vector(normal);
+          for (int c = 0; c < 3; c++) {
+            features.albedo[3 * p + c] = float(albedo[c]);
+            features.normal[3 * p + c] = float(normal[c]);
+          }
+          features.depth[p] = float(depth / (grid * grid));
+        }
+      }
+    });
+    return features;
+  }
+
+  // Traces a 2x2 grid of camera rays, or paths, through every pixel and
+  // writes the average BVH nodes visited and primitives tested per ray as
+  // false-colour PNGs. Each image is scaled to its 99.5th percentile so a
+  // few extreme pixels do not wash out the rest.
+  void write_heatmaps(const hittable& world, const hittable_list& lights,
+                      unsigned threads, const std::string& filename) const {
+    if (!render_stats_enabled) {
+      std::cerr << "ERROR: Heatmaps need a build with -DRAYTRACER_STATS=ON\n";
+      return;
+    }
+
+    const int grid = 2;
+    const size_t count = size_t(image_width) * image_height;
+    std::vector<float> nodes(count), tests(count);
+    auto primitive_tests = [](const render_stats& s) {
+      return s[stat_counter::sphere_tests] + s[stat_counter::quad_tests] +
+             s[stat_counter::triangle_tests];
+    };
+
+    parallel_for(0, size_t(image_height), 8, threads,
+                 [&](size_t j0, size_t j1) {
+      for (int j = int(j0); j < int(j1); j++) {
+        for (int i = 0; i < image_width; i++) {
+          const size_t p = size_t(idx(i, j));
+          const uint64_t pixel = (uint64_t(uint32_t(i)) << 32) | uint32_t(j);
+          thread_rng().seed(mix_bits(render_seed ^ mix_bits(pixel)),
+                            ~uint64_t(1));
+
+          const render_stats before = thread_stats();
+          for (int s = 0; s < grid * grid; s++) {
+            const vec3<real> offset((s % grid + 0.5) / grid - 0.5,
+                                    (s / grid + 0.5) / grid - 0.5, 0);
+            const ray r = camera_ray(i, j, offset);
+            if (heatmap_paths) {
+              uint64_t rays = 0;
+              ray_color(r, world, lights, rays);
+            } else {
+              hit_record rec;
+              world.hit(r, interval(0.001, infinity), rec);
+            }
+          }
+          const render_stats& after = thread_stats();
+          nodes[p] = float(after[stat_counter::bvh_nodes] -
+                           before[stat_counter::bvh_nodes]) / (grid * grid);
+          tests[p] = float(primitive_tests(after) - primitive_tests(before)) /
+                     (grid * grid);
+        }
+      }
+    });
+
+    out() << "Heatmaps (per " << (heatmap_paths ? "path" : "camera ray")
+          << "):\n";
+    const std::pair<const char*, std::vector<float>*> maps[] = {
+        {"nodes", &nodes}, {"tests", &tests}};
+    for (const auto& [name, values] : maps) {
+      std::vector<float> sorted = *values;
+      const size_t k = std::min(count - 1, size_t(0.995 * count));
+      std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+      const float scale = std::max(sorted[k], 1.0f);
+
+      std::vector<float> raster(3 * count);
+      for (size_t p = 0; p < count; p++) {
+        const color c = false_colour((*values)[p] / scale);
+        for (int ch = 0; ch < 3; ch++) raster[3 * p + ch] = float(c[ch]);
+      }
+      const std::string heatmap_filename = with_extension(
+          with_suffix(filename, std::string("-heatmap-") + name), ".png");
+      write_png(heatmap_filename, raster);
+      out() << "  " << (name[0] == 'n' ? "BVH nodes" : "primitive tests")
+            << ", 0 to " << std::setprecision(1) << scale << ": "
+            << heatmap_filename << "\n";
+    }
+  }
+
+  // Dark blue through cyan, green and yellow to red for t in [0, 1].
+  static color false_colour(float t) {
+    static const color stops[] = {
+        color(0.0, 0.0, 0.2), color(0.0, 0.3, 1.0), color(0.0, 0.9, 0.9),
+        color(0.2, 0.9, 0.1), color(1.0, 0.9, 0.0), color(1.0, 0.1, 0.0)};
+    const int last = int(sizeof(stops) / sizeof(stops[0])) - 1;
+    const float x = std::clamp(t, 0.0f, 1.0f) * last;
+    const int k = std::min(int(x), last - 1);
+    const real f = x - k;
+    return (1 - f) * stops[k] + f * stops[k + 1];
+  }
+
+  // Writes a gamma-encoded raster as an 8-bit PNG, clamping like the JPEG
+  // conversion does. The file is replaced in one step so viewers never see
+  // a partial image.
+  void write_png(const std::string& filename,
+                 const std::vector<float>& raster) const {
+    std::vector<unsigned char> bytes(raster.size());
+    for (size_t k = 0; k < raster.size(); k++) {
+      const float v = std::clamp(raster[k], 0.0f, 1.0f);
+      bytes[k] = (unsigned char)(255.0f * v + 0.5f);
+    }
+
+    const std::string temp = filename + ".tmp";
+    if (stbi_write_png(temp.c_str(), image_width, image_height, 3,
+                       bytes.data(), image_width * 3) == 0 ||
+        std::rename(temp.c_str(), filename.c_str()) != 0) {
+      std::cerr << "\nERROR: Failed to write PNG image: " << filename << "\n";
+      std::remove(temp.c_str());
+    }
+  }
+
+  // Adds samples to `px` until it holds `target` of them. Strata are
+  // visited in stratum_stride order; in adaptive mode the pixel is checked
+  // for convergence every adaptive_batch samples, so where a pass ends
+  // does not change where it stops.
+  void render_pixel(int i, int j, const hittable& world,
+                    const hittable_list& lights, uint64_t& rays, int target,
+                    pixel_accumulator& px) const {
+    const int min_samples =
+        std::clamp(min_samples_per_pixel, 1, sqrt_spp * sqrt_spp);
+    if (px.count % adaptive_batch == 0 && converged(px, min_samples)) return;
+
+    pixel_sampler values(sampler, render_seed);
+    sampler_scope scope(values.low_discrepancy() ? &values : nullptr);
+
+    for (int s = int(px.count); s < target; s++) {
+      start_sample(values, i, j, s);
+      ray r = get_ray(i, j, s);
+      add_sample(px, ray_color(r, world, lights, rays));
+
+      if (px.count % adaptive_batch == 0 && converged(px, min_samples)) break;
+    }
+  }
+
+  // Whether adaptive sampling can stop `px`. Without light sampling most
+  // paths return black, and a run of black samples has zero variance
+  // without being converged, so the estimate is only trusted once enough
+  // samples carried light.
+  bool converged(const pixel_accumulator& px, int min_samples) const {
+    if (adaptive_threshold <= 0 || int(px.count) < min_samples ||
+        px.contributing < uint32_t(min_contributing_samples))
+      return false;
+    const double n = px.count;
+    const double error = 1.96 * std::sqrt(px.luminance_m2 / (n - 1) / n);
+    return error <= adaptive_threshold * std::max(px.luminance_mean, 1e-2);
+  }
+
+  // Adds `sample` to the radiance sum and to Welford's running mean and
+  // variance of the luminance.
+  static void add_sample(pixel_accumulator& px, const color& sample) {
+    px.sum[0] += sample.x();
+    px.sum[1] += sample.y();
+    px.sum[2] += sample.z();
+    px.count++;
+
+    const double y = luminance(sample);
+    const double delta = y - px.luminance_mean;
+    px.luminance_mean += delta / px.count;
+    px.luminance_m2 += delta * (y - px.luminance_mean);
+    if (y > 0) px.contributing++;
+  }
+
+  // Renders tile `t` in blocks of packet_width x packet_height pixels up to
+  // `target` samples per pixel. For every sample index the block's camera
+  // rays are intersected as one packet and each lane's path is then
+  // continued on its own. `pixel(i, j)` gives the accumulator of a pixel;
+  // lanes join once the index reaches the samples their pixel already has.
+  template <typename F>
+  void render_tile_packets(const tile& t, const hittable& world,
+                           const hittable_list& lights, uint64_t& rays,
+                           int target, F&& pixel) const {
+    static_assert(packet_width * packet_height == ray_packet::size,
+                  "packet block must match the packet size");
+
+    ray_packet packet;
+    hit_record recs[ray_packet::size];
+    uint32_t path_dimension[ray_packet::size];
+    pcg32 path_rng[ray_packet::size];
+    pixel_accumulator* accumulators[ray_packet::size];
+
+    pixel_sampler values(sampler, render_seed);
+    sampler_scope scope(values.low_discrepancy() ? &values : nullptr);
+
+    for (int y = t.y0; y < t.y1; y += packet_height) {
+      for (int x = t.x0; x < t.x1; x += packet_width) {
+        uint32_t lanes = 0;
+        int first = target;
+        for (int lane = 0; lane < ray_packet::size; lane++) {
+          const int i = x + lane % packet_width;
+          const int j = y + lane / packet_width;
+          if (i >= t.x1 || j >= t.y1) continue;
+          accumulators[lane] = &pixel(i, j);
+          if (int(accumulators[lane]->count) < target) {
+            lanes |= 1u << lane;
+            first = std::min(first, int(accumulators[lane]->count));
+          }
+        }
+
+        for (int s = first; s < target; s++) {
+          packet.t_min = 0.001;
+          packet.active = 0;
+          packet.hit = 0;
+          for (int lane = 0; lane < ray_packet::size; lane++) {
+            if (!(lanes & (1u << lane)) ||
+                s < int(accumulators[lane]->count))
+              continue;
+            const int i = x + lane % packet_width;
+            const int j = y + lane / packet_width;
+            start_sample(values, i, j, s);
+            packet.rays[lane] = get_ray(i, j, s);
+            path_dimension[lane] = values.dimension();
+            path_rng[lane] = thread_rng();
+            packet.t_max[lane] = infinity;
+            packet.active |= 1u << lane;
+            rays++;
+          }
+          const uint32_t active = packet.active;
+
+          world.hit_packet(packet, recs);
+
+          // Each path resumes its pixel's sample where the camera ray left
+          // off.
+          for (int lane = 0; lane < ray_packet::size; lane++) {
+            if (!(active & (1u << lane))) continue;
+            values.start(x + lane % packet_width, y + lane / packet_width, s,
+                         path_dimension[lane]);
+            thread_rng() = path_rng[lane];
+            add_sample(*accumulators[lane],
+                       path_radiance(packet.rays[lane],
+                                     packet.hit & (1u << lane), recs[lane],
+                                     world, lights, rays));
+          }
+        }
+      }
+    }
+  }
+
+  // Starts sample `index` of pixel (i, j): both the low-discrepancy values
+  // and the thread's generator restart from streams that depend on nothing
+  // but render_seed, the pixel and the index.
+  void start_sample(pixel_sampler& values, int i, int j, int index) const {
+    values.start(i, j, uint32_t(index));
+    const uint64_t pixel = (uint64_t(uint32_t(i)) << 32) | uint32_t(j);
+    thread_rng().seed(mix_bits(render_seed ^ mix_bits(pixel)), uint64_t(index));
+  }
+
+  // FNV-1a over the bytes of the image, for spotting changed renders.
+  static uint64_t image_hash(const std::vector<float>& raster) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const auto* bytes = reinterpret_cast<const unsigned char*>(raster.data());
+    for (size_t k = 0; k < raster.size() * sizeof(float); k++) {
+      hash = (hash ^ bytes[k]) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  // Camera ray for sample `s` of pixel (i, j). Only the stratified sampler
+  // places the first grid_size^2 samples in strata; the others, and samples
+  // added by raising samples_per_pixel on resume, draw the offset like any
+  // other sample.
+  ray get_ray(int i, int j, int s) const {
+    RT_STAT(camera_rays);
+    const int strata = grid_size * grid_size;
+    vec3<real> offset;
+    if (sampler == sampler_type::stratified && s < strata) {
+      const int stratum = int((int64_t(s) * stratum_stride) % strata);
+      offset = sample_square_stratified(stratum % grid_size,
+                                        stratum / grid_size);
+    } else {
+      offset = sample_square();
+    }
+    return camera_ray(i, j, offset);
+  }
+
+  // Camera ray through `offset` from the centre of pixel (i, j).
+  ray camera_ray(int i, int j, const vec3<real>& offset) const {
     auto pixel_sample = pixel00_loc 
                       + ((i + offset.x()) * pixel_delta_u)
                       + ((j + offset.y()) * pixel_delta_v);
@@ -188,15 +1032,15 @@ class camera {
     return ray(ray_origin, ray_direction, ray_time);
   }
 
-  vec3<double> sample_square_stratified(int s_i, int s_j) const {
-    auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-    auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
+  vec3<real> sample_square_stratified(int s_i, int s_j) const {
+    auto px = ((s_i + random_double()) * recip_grid_size) - 0.5;
+    auto py = ((s_j + random_double()) * recip_grid_size) - 0.5;
 
-    return vec3<double>(px, py, 0);
+    return vec3<real>(px, py, 0);
   }
 
-  vec3<double> sample_square() const {
-    return vec3<double>(random_double() - 0.5, random_double() - 0.5, 0);
+  vec3<real> sample_square() const {
+    return vec3<real>(random_double() - 0.5, random_double() - 0.5, 0);
   }
 
   point3 defocus_disk_sample() const {
@@ -204,26 +1048,123 @@ class camera {
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 
-  color ray_color(const ray& r, int depth,
-                          const hittable& world) const {
-    if (depth <= 0) {
-      return color(0.0, 0.0, 0.0);
-    }
+  // Power heuristic (beta = 2) weight of a sample drawn with density
+  // `pdf_a` against an alternative strategy with density `pdf_b`.
+  static real power_heuristic(real pdf_a, real pdf_b) {
+    const real a = pdf_a * pdf_a;
+    const real b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0.0;
+  }
 
+  // Iterative path tracer. `throughput` is the product of the attenuations
+  // along the path so far; after russian_roulette_depth bounces a path
+  // survives with probability equal to its largest throughput component and
+  // is reweighted by 1/p, which keeps the estimate unbiased. max_depth stays
+  // a hard cap on the number of rays per path.
+  //
+  // At non-specular vertices one shadow ray is also traced towards a point
+  // picked from `lights`. Emission is then reachable by two strategies, so
+  // both the shadow ray and a BSDF-sampled ray that lands on an emitter are
+  // weighted with the power heuristic. Emission seen straight from the camera
+  // or after a specular bounce can only come from BSDF sampling and keeps
+  // full weight, as does emission from objects missing from `lights`, whose
+  // light pdf is zero.
+  color ray_color(const ray& r, const hittable& world,
+                  const hittable_list& lights, uint64_t& rays) const {
     hit_record rec;
+    rays++;
+    const bool hit = world.hit(r, interval(0.001, infinity), rec);
+    return path_radiance(r, hit, rec, world, lights, rays);
+  }
 
-    if (!world.hit(r, interval(0.001, infinity), rec))
-      return background;
+  // The path tracer behind ray_color() for a ray whose first intersection
+  // is already known: `rec` if `hit`, nothing otherwise.
+  color path_radiance(const ray& r, bool hit, hit_record rec,
+                      const hittable& world, const hittable_list& lights,
+                      uint64_t& rays) const {
+    const bool sample_lights = !lights.objects.empty();
 
-    ray scattered;
-    color attenuation;
-    color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+    color radiance(0.0, 0.0, 0.0);
+    color throughput(1.0, 1.0, 1.0);
+    ray current = r;
+    real scatter_pdf = 0.0;  // Density of `current`, 0 if specular
+
+    for (int depth = 0; depth < max_depth; depth++) {
+      if (depth > 0) {
+        rays++;
+        RT_STAT_BOUNCE(depth);
+        hit = world.hit(current, interval(0.001, infinity), rec);
+      }
+
+      if (!hit) {
+        radiance += throughput * background;
+        break;
+      }
+
+      color emitted = rec.mat->emitted(rec.u, rec.v, rec.p);
+      if (emitted.length_squared() > 0) {
+        real weight = 1.0;
+        if (sample_lights && scatter_pdf > 0) {
+          real light_pdf =
+              lights.pdf_value(current.origin(), current.direction());
+          weight = power_heuristic(scatter_pdf, light_pdf);
+        }
+        radiance += weight * throughput * emitted;
+      }
 
-    if (!rec.mat->scatter(r, rec, attenuation, scattered))
-      return color_from_emission;
+      ray scattered;
+      color attenuation;
+      if (!rec.mat->scatter(current, rec, attenuation, scattered)) break;
 
-    color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+      scatter_pdf = 0.0;
+      if (sample_lights && !rec.mat->is_specular()) {
+        radiance += throughput * sample_light(current, rec, world, lights, rays);
+        scatter_pdf =
+            rec.mat->scattering_pdf(current, rec, scattered.direction());
+      }
+
+      throughput = throughput * attenuation;
+
+      if (depth + 1 >= russian_roulette_depth) {
+        real survive = std::min<real>(
+            0.95, std::max({throughput.x(), throughput.y(), throughput.z()}));
+        if (random_double() >= survive) break;
+        throughput /= survive;
+      }
+
+      if (depth + 1 == max_depth) RT_STAT(max_depth_paths);
+      current = scattered;
+    }
+
+    return radiance;
+  }
+
+  // MIS-weighted radiance arriving at `rec` from one point sampled on
+  // `lights`, already multiplied by the BSDF and cosine term.
+  color sample_light(const ray& r_in, const hit_record& rec,
+                     const hittable& world, const hittable_list& lights,
+                     uint64_t& rays) const {
+    const vec3<real> direction = lights.random(rec.p);
+    const real light_pdf = lights.pdf_value(rec.p, direction);
+    if (light_pdf <= 0) return color(0.0, 0.0, 0.0);
+
+    const color f = rec.mat->eval(r_in, rec, direction);
+    if (f.length_squared() <= 0) return color(0.0, 0.0, 0.0);
+
+    // The first surface along the shadow ray must be the emitter; anything
+    // else, including a scattering event inside a medium, occludes it.
+    hit_record light_rec;
+    rays++;
+    RT_STAT(shadow_rays);
+    if (!world.hit(rec.spawn(direction, r_in.time()),
+                   interval(0.001, infinity), light_rec)) {
+      return color(0.0, 0.0, 0.0);
+    }
 
-    return color_from_emission + color_from_scatter;
+    const color emitted =
+        light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p);
+    const real weight =
+        power_heuristic(light_pdf, rec.mat->scattering_pdf(r_in, rec, direction));
+    return (weight / light_pdf) * f * emitted;
   }
 };
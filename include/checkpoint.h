@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Samples accumulated so far for one pixel. Sample values are a function
+// of the seed, the pixel and the sample index, so `count` is all the state
+// the sampler needs to continue.
+struct pixel_accumulator {
+  double sum[3] = {0, 0, 0};  // Radiance
+  double luminance_mean = 0;  // Running luminance statistics (Welford) for
+  double luminance_m2 = 0;    // adaptive sampling
+  uint32_t count = 0;
+  uint32_t contributing = 0;  // Samples that carried light
+};
+
+// On-disk state of a render: the accumulators of every pixel and what the
+// camera needs to continue exactly where it stopped. The file is a fixed
+// header followed by the accumulators, in the byte order of the machine
+// that wrote it.
+struct render_checkpoint {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t grid = 0;          // Edge of the stratification grid
+  uint32_t stride = 0;        // Order in which the strata are visited
+  uint32_t sampler = 0;       // sampler_type
+  uint64_t seed = 0;
+  uint64_t scene_hash = 0;
+  std::vector<pixel_accumulator> pixels;
+
+  static bool exists(const std::string& path) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (f) std::fclose(f);
+    return f != nullptr;
+  }
+
+  // Writes to a temporary file that then replaces `path`, so a crash while
+  // writing leaves the previous checkpoint intact.
+  bool write(const std::string& path) const {
+    const std::string temp = path + ".tmp";
+    std::FILE* f = std::fopen(temp.c_str(), "wb");
+    if (!f) {
+      std::cerr << "\nERROR: Could not write checkpoint: " << temp << "\n";
+      return false;
+    }
+
+    header h{};
+    std::memcpy(h.magic, magic, sizeof(h.magic));
+    h.version = version;
+    h.width = width;
+    h.height = height;
+    h.grid = grid;
+    h.stride = stride;
+    h.sampler = sampler;
+    h.seed = seed;
+    h.scene_hash = scene_hash;
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+              std::fwrite(pixels.data(), sizeof(pixel_accumulator),
+                          pixels.size(), f) == pixels.size();
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+      std::cerr << "\nERROR: Could not write checkpoint: " << path << "\n";
+      std::remove(temp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Reads `path`; with header_only the accumulators are skipped. Prints the
+  // reason and returns false if the file is missing or malformed.
+  bool read(const std::string& path, bool header_only = false) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+      std::cerr << "ERROR: Could not open checkpoint: " << path << "\n";
+      return false;
+    }
+
+    header h;
+    bool ok = std::fread(&h, sizeof(h), 1, f) == 1 &&
+              std::memcmp(h.magic, magic, sizeof(h.magic)) == 0 &&
+              h.version == version && h.grid > 0 && h.stride > 0;
+    if (ok) {
+      width = h.width;
+      height = h.height;
+      grid = h.grid;
+      stride = h.stride;
+      sampler = h.sampler;
+      seed = h.seed;
+      scene_hash = h.scene_hash;
+      if (!header_only) {
+        // The dimensions must agree with the file size before they decide
+        // the allocation, so a corrupt header cannot ask for gigabytes.
+        const uint64_t count = uint64_t(width) * height;
+        ok = count > 0 && file_size(f) == sizeof(header) +
+                                              count * sizeof(pixel_accumulator);
+        if (ok) {
+          pixels.assign(size_t(count), pixel_accumulator());
+          ok = std::fread(pixels.data(), sizeof(pixel_accumulator),
+                          pixels.size(), f) == pixels.size();
+        }
+      }
+    }
+    std::fclose(f);
+
+    if (!ok) {
+      std::cerr << "ERROR: Not a valid checkpoint: " << path << "\n";
+    }
+    return ok;
+  }
+
+ private:
+  static constexpr char magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', 0, 0};
+  static const uint32_t version = 1;
+
+  struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t width, height, grid, stride, sampler;
+    uint64_t seed, scene_hash;
+  };
+
+  // Size of `f` in bytes; leaves the position where it was.
+  static uint64_t file_size(std::FILE* f) {
+    const long position = std::ftell(f);
+    if (position < 0 || std::fseek(f, 0, SEEK_END) != 0) return 0;
+    const long size = std::ftell(f);
+    std::fseek(f, position, SEEK_SET);
+    return size < 0 ? 0 : uint64_t(size);
+  }
+};
@@ -5,9 +5,13 @@
 #include "interval.h"
 #include "vec3.h"
 
-using color = vec3<double>;
+using color = vec3<real>;
 using color8 = vec3<uint8_t>;
 
+inline real luminance(const color& c) {
+  return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 inline float linear_to_gama(float linear_component) {
   if (linear_component > 0) {
     return std::sqrt(linear_component);
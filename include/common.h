@@ -5,34 +5,45 @@
 #include <iostream>
 #include <limits>
 #include <memory>
-#include <random>
-#include <thread>
+
+#include "render_stats.h"
+#include "rng.h"
+#include "sampler.h"
 
 // C++ Std Usings
 
 using std::make_shared;
 using std::shared_ptr;
 
+// Scalar type of the render kernel. Builds configured with
+// -DRAYTRACER_USE_FLOAT=ON trace in single precision.
+
+#if defined(RAYTRACER_USE_FLOAT)
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = real(3.1415926535897932385);
+
+// Rays leaving a surface start this far from it, relative to the largest
+// coordinate of the hit point, so they cannot hit it again through rounding.
+const real ray_offset_scale = 64 * std::numeric_limits<real>::epsilon();
 
 // Utility Functions
 
-inline double degrees_to_radians(double degrees) {
+inline real degrees_to_radians(real degrees) {
   return degrees * pi / 180.0;
 }
 
+// Uniform in [0, 1): the next dimension of the active pixel sampler while
+// the camera traces a low-discrepancy sample, the thread's PCG otherwise.
 inline double random_double() {
-  thread_local std::mt19937_64 rng([] {
-    std::random_device rd;
-    auto seed = (uint64_t(rd()) << 32) ^ uint64_t(rd()) ^
-                std::hash<std::thread::id>{}(std::this_thread::get_id());
-    return std::mt19937_64(seed);
-  }());
-  thread_local std::uniform_real_distribution<double> dist(0.0, 1.0);
-  return dist(rng);
+  if (active_sampler) return active_sampler->next();
+  return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
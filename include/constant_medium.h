@@ -6,12 +6,12 @@
 
 class constant_medium : public hittable {
  public:
-  constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex)
+  constant_medium(shared_ptr<hittable> boundary, real density, shared_ptr<texture> tex)
     : boundary(boundary), neg_inv_density(-1 / density),
       phase_function(make_shared<isotropic>(tex))
   {}
 
-  constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
+  constant_medium(shared_ptr<hittable> boundary, real density, const color& albedo)
     : boundary(boundary), neg_inv_density(-1 / density),
       phase_function(make_shared<isotropic>(albedo))
   {}
@@ -19,9 +19,14 @@ class constant_medium : public hittable {
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
     hit_record rec1, rec2;
 
+    RT_STAT(medium_queries);
     if (!boundary->hit(r, interval::universe, rec1)) return false;
 
-    if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2)) return false;
+    // The exit search starts just past the entry point; the gap grows with t
+    // so it still moves past rec1.t when t is large in single precision.
+    auto gap = std::fmax(real(0.0001), std::fabs(rec1.t) * ray_offset_scale);
+    RT_STAT(medium_queries);
+    if (!boundary->hit(r, interval(rec1.t + gap, infinity), rec2)) return false;
 
     if (rec1.t < ray_t.min) rec1.t = ray_t.min;
     if (rec2.t > ray_t.max) rec2.t = ray_t.max;
@@ -39,9 +44,9 @@ class constant_medium : public hittable {
     rec.t = rec1.t + hit_distance / ray_length;
     rec.p = r.at(rec.t);
 
-    rec.normal = vec3<double>(1, 0, 0);
+    rec.normal = vec3<real>(1, 0, 0);
     rec.front_face = true;
-    rec.mat = phase_function;
+    rec.mat = phase_function.get();
 
     return true;
   }
@@ -50,6 +55,6 @@ class constant_medium : public hittable {
 
 private:
   shared_ptr<hittable> boundary;
-  double neg_inv_density;
+  real neg_inv_density;
   shared_ptr<material> phase_function;
 };
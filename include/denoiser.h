@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "parallel.h"
+
+// First-hit surface properties of every pixel, averaged over a few camera
+// rays. Misses and lights count as white with a zero normal and depth.
+struct feature_buffers {
+  std::vector<float> albedo;  // RGB
+  std::vector<float> normal;  // XYZ, renormalized after averaging
+  std::vector<float> depth;   // Distance from the camera to the first hit
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided like
+// SVGF (Schied et al. 2017), minus its temporal part. The radiance is
+// divided by the albedo so texture detail never enters the filter, and the
+// resulting illumination is blurred by five 5x5 passes with growing gaps.
+// Taps are weighted down across normal and depth discontinuities, and
+// across luminance differences large compared to the pixel's estimated
+// noise, so converged pixels stay sharp while noisy ones are smoothed.
+class denoiser {
+ public:
+  int iterations = 5;
+  float sigma_normal = 128;   // Exponent on the cosine between normals
+  float sigma_depth = 1;      // In units of the local depth gradient
+  float sigma_luminance = 4;  // In standard deviations of the noise
+
+  // `radiance` is linear RGB and `variance` the variance of each pixel's
+  // mean luminance. Returns the filtered linear RGB.
+  std::vector<float> filter(int width, int height,
+                            const std::vector<float>& radiance,
+                            const std::vector<float>& variance,
+                            const feature_buffers& features,
+                            unsigned threads) const {
+    const size_t count = size_t(width) * height;
+    std::vector<float> color(3 * count), next_color(3 * count);
+    std::vector<float> var(count), next_var(count);
+    std::vector<float> depth_gradient(count);
+
+    for (size_t p = 0; p < count; p++) {
+      float albedo_luminance = 0;
+      for (int c = 0; c < 3; c++) {
+        const float a = demodulation(features.albedo[3 * p + c]);
+        color[3 * p + c] = radiance[3 * p + c] / a;
+        albedo_luminance += luminance_weights[c] * a;
+      }
+      var[p] = variance[p] / (albedo_luminance * albedo_luminance);
+    }
+
+    parallel_for(0, size_t(height), 8, threads, [&](size_t y0, size_t y1) {
+      for (int y = int(y0); y < int(y1); y++) {
+        for (int x = 0; x < width; x++) {
+          auto z = [&](int i, int j) {
+            i = std::clamp(i, 0, width - 1);
+            j = std::clamp(j, 0, height - 1);
+            return features.depth[size_t(j) * width + i];
+          };
+          depth_gradient[size_t(y) * width + x] =
+              0.5f * std::max(std::fabs(z(x + 1, y) - z(x - 1, y)),
+                              std::fabs(z(x, y + 1) - z(x, y - 1)));
+        }
+      }
+    });
+
+    for (int it = 0; it < iterations; it++) {
+      const int step = 1 << it;
+      parallel_for(0, size_t(height), 8, threads, [&](size_t y0, size_t y1) {
+        for (int y = int(y0); y < int(y1); y++) {
+          for (int x = 0; x < width; x++) {
+            filter_pixel(x, y, step, width, height, color, var,
+                         depth_gradient, features, next_color, next_var);
+          }
+        }
+      });
+      color.swap(next_color);
+      var.swap(next_var);
+    }
+
+    for (size_t p = 0; p < count; p++) {
+      for (int c = 0; c < 3; c++) {
+        color[3 * p + c] *= demodulation(features.albedo[3 * p + c]);
+      }
+    }
+    return color;
+  }
+
+ private:
+  static constexpr float kernel[3] = {3.0f / 8, 1.0f / 4, 1.0f / 16};
+  static constexpr float luminance_weights[3] = {0.2126f, 0.7152f, 0.0722f};
+
+  static float demodulation(float albedo) { return std::max(albedo, 1e-3f); }
+
+  static float luminance_of(const float* rgb) {
+    return luminance_weights[0] * rgb[0] + luminance_weights[1] * rgb[1] +
+           luminance_weights[2] * rgb[2];
+  }
+
+  // 3x3 Gaussian blur of the variance around (x, y), which steadies the
+  // luminance weight against the noise in the variance estimate itself.
+  static float blurred_variance(int x, int y, int width, int height,
+                                const std::vector<float>& var) {
+    static const float gaussian[2] = {1.0f / 2, 1.0f / 4};
+    float sum = 0, weight = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        const int i = x + dx, j = y + dy;
+        if (i < 0 || j < 0 || i >= width || j >= height) continue;
+        const float w = gaussian[std::abs(dx)] * gaussian[std::abs(dy)];
+        sum += w * var[size_t(j) * width + i];
+        weight += w;
+      }
+    }
+    return sum / weight;
+  }
+
+  void filter_pixel(int x, int y, int step, int width, int height,
+                    const std::vector<float>& color,
+                    const std::vector<float>& var,
+                    const std::vector<float>& depth_gradient,
+                    const feature_buffers& features,
+                    std::vector<float>& out_color,
+                    std::vector<float>& out_var) const {
+    const size_t p = size_t(y) * width + x;
+    const float* np = &features.normal[3 * p];
+    const float zp = features.depth[p];
+    const float lp = luminance_of(&color[3 * p]);
+    const float deviation =
+        std::sqrt(blurred_variance(x, y, width, height, var));
+    const float luminance_scale = sigma_luminance * deviation + 1e-6f;
+    const float depth_scale = sigma_depth * depth_gradient[p] + 1e-6f;
+
+    float center = kernel[0] * kernel[0];
+    float sum[3] = {center * color[3 * p], center * color[3 * p + 1],
+                    center * color[3 * p + 2]};
+    float weight_sum = center;
+    float var_sum = center * center * var[p];
+
+    for (int dy = -2; dy <= 2; dy++) {
+      for (int dx = -2; dx <= 2; dx++) {
+        if (dx == 0 && dy == 0) continue;
+        const int i = x + dx * step, j = y + dy * step;
+        if (i < 0 || j < 0 || i >= width || j >= height) continue;
+
+        const size_t q = size_t(j) * width + i;
+        const float* nq = &features.normal[3 * q];
+        const float cosine = np[0] * nq[0] + np[1] * nq[1] + np[2] * nq[2];
+        if (cosine <= 0) continue;
+
+        const float distance = step * std::sqrt(float(dx * dx + dy * dy));
+        const float w_normal = std::pow(cosine, sigma_normal);
+        const float w_depth_luminance = std::exp(
+            -std::fabs(zp - features.depth[q]) / (depth_scale * distance) -
+            std::fabs(lp - luminance_of(&color[3 * q])) / luminance_scale);
+        const float w = kernel[std::abs(dx)] * kernel[std::abs(dy)] *
+                        w_normal * w_depth_luminance;
+
+        for (int c = 0; c < 3; c++) sum[c] += w * color[3 * q + c];
+        weight_sum += w;
+        var_sum += w * w * var[q];
+      }
+    }
+
+    for (int c = 0; c < 3; c++) out_color[3 * p + c] = sum[c] / weight_sum;
+    out_var[p] = var_sum / (weight_sum * weight_sum);
+  }
+};
@@ -8,17 +8,31 @@ class material;
 class hit_record {
  public:
   point3 p;
-  vec3<double> normal;
-  std::shared_ptr<material> mat;
-  double t;
-  double u;
-  double v;
+  vec3<real> normal;
+  // Non-owning; the primitives that produce the hit own their materials.
+  const material* mat = nullptr;
+  real t;
+  real u;
+  real v;
   bool front_face;
 
-  void set_face_normal(const ray& r, const vec3<double>& outward_normal) {
+  void set_face_normal(const ray& r, const vec3<real>& outward_normal) {
     front_face = dot(r.direction(), outward_normal) < 0;
     normal = front_face ? outward_normal : -outward_normal;
   }
+
+  // Ray leaving the hit point along `direction`. Its origin is nudged off the
+  // surface, onto the side `direction` points to, by ray_offset_scale of the
+  // point's magnitude so it cannot re-hit the surface through rounding.
+  ray spawn(const vec3<real>& direction, real time) const {
+    auto magnitude = std::fmax(
+        real(1), std::fmax(std::fabs(p.x()),
+                           std::fmax(std::fabs(p.y()), std::fabs(p.z()))));
+    auto offset = ray_offset_scale * magnitude;
+    auto origin = dot(direction, normal) > 0 ? p + offset * normal
+                                             : p - offset * normal;
+    return ray(origin, direction, time);
+  }
 };
 
 class hittable {
@@ -28,11 +42,36 @@ class hittable {
   virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
   virtual aabb bounding_box() const = 0;
+
+  // Packet version of hit(): records for lanes that hit go to recs[lane].
+  // The default traces the active lanes one at a time.
+  virtual void hit_packet(ray_packet& packet, hit_record* recs) const {
+    for (int lane = 0; lane < ray_packet::size; lane++) {
+      if (!(packet.active & (1u << lane))) continue;
+      interval ray_t(packet.t_min, packet.t_max[lane]);
+      if (hit(packet.rays[lane], ray_t, recs[lane])) {
+        packet.t_max[lane] = recs[lane].t;
+        packet.hit |= 1u << lane;
+      }
+    }
+  }
+
+  // Solid-angle density, seen from `origin`, with which random() picks
+  // `direction`. Only emitters used for light sampling implement these.
+  virtual real pdf_value(const point3& origin,
+                         const vec3<real>& direction) const {
+    return 0.0;
+  }
+
+  // Direction from `origin` towards a random point on this object.
+  virtual vec3<real> random(const point3& origin) const {
+    return vec3<real>(1, 0, 0);
+  }
 };
 
 class translate : public hittable {
  public:
-  translate(shared_ptr<hittable> object, const vec3<double>& offset)
+  translate(shared_ptr<hittable> object, const vec3<real>& offset)
     : object(object), offset(offset) {
     bbox = object->bounding_box() + offset;
   }
@@ -52,13 +91,13 @@ class translate : public hittable {
 
  private:
   shared_ptr<hittable> object;
-  vec3<double> offset;
+  vec3<real> offset;
   aabb bbox;
 };
 
 class rotate_y : public hittable {
  public: 
-  rotate_y(shared_ptr<hittable> object, double angle) : object(object) {
+  rotate_y(shared_ptr<hittable> object, real angle) : object(object) {
     auto radians = degrees_to_radians(angle);
     sin_theta = std::sin(radians);
     cos_theta = std::cos(radians);
@@ -127,7 +166,7 @@ class rotate_y : public hittable {
 
  private:
   shared_ptr<hittable> object;
-  double sin_theta;
-  double cos_theta;
+  real sin_theta;
+  real cos_theta;
   aabb bbox;
 };
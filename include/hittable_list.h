@@ -18,23 +18,48 @@ class hittable_list : public hittable {
     bbox = aabb(bbox, object->bounding_box());
   }
 
+  // Objects only write `rec` when they report a hit, and each hit is closer
+  // than the previous one, so no temporary record is needed.
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = ray_t.max;
 
     for (const auto& object : objects) {
-      if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+      if (object->hit(r, interval(ray_t.min, closest_so_far), rec)) {
         hit_anything = true;
-        closest_so_far = temp_rec.t;
-        rec = temp_rec;
+        closest_so_far = rec.t;
       }
     }
 
     return hit_anything;
   }
 
+  void hit_packet(ray_packet& packet, hit_record* recs) const override {
+    for (const auto& object : objects) {
+      object->hit_packet(packet, recs);
+    }
+  }
+
   aabb bounding_box() const override { return bbox; }
+
+  // Light sampling picks one object uniformly, so the density of a direction
+  // is the average of the objects' densities.
+  real pdf_value(const point3& origin,
+                 const vec3<real>& direction) const override {
+    if (objects.empty()) return 0.0;
+
+    auto sum = 0.0;
+    for (const auto& object : objects) {
+      sum += object->pdf_value(origin, direction);
+    }
+    return sum / objects.size();
+  }
+
+  vec3<real> random(const point3& origin) const override {
+    auto size = int(objects.size());
+    return objects[random_int(0, size - 1)]->random(origin);
+  }
+
  private:
   aabb bbox = aabb::empty;
 };
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "hittable.h"
+
+// Affine map p -> A p + b stored as a row-major 3x4 matrix [A | b].
+class affine_transform {
+ public:
+  real m[3][4];
+
+  affine_transform() {
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 4; c++) m[r][c] = (r == c) ? 1.0 : 0.0;
+  }
+
+  static affine_transform translation(const vec3<real>& offset) {
+    affine_transform t;
+    for (int r = 0; r < 3; r++) t.m[r][3] = offset[r];
+    return t;
+  }
+
+  static affine_transform scaling(const vec3<real>& factors) {
+    affine_transform t;
+    for (int r = 0; r < 3; r++) t.m[r][r] = factors[r];
+    return t;
+  }
+
+  // Right-handed rotation by `angle` degrees about `axis`.
+  static affine_transform rotation(const vec3<real>& axis, real angle) {
+    auto a = unit_vector(axis);
+    auto radians = degrees_to_radians(angle);
+    auto s = std::sin(radians);
+    auto c = std::cos(radians);
+    auto k = 1 - c;
+
+    affine_transform t;
+    t.m[0][0] = c + a.x()*a.x()*k;
+    t.m[0][1] = a.x()*a.y()*k - a.z()*s;
+    t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+    t.m[1][0] = a.y()*a.x()*k + a.z()*s;
+    t.m[1][1] = c + a.y()*a.y()*k;
+    t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+    t.m[2][0] = a.z()*a.x()*k - a.y()*s;
+    t.m[2][1] = a.z()*a.y()*k + a.x()*s;
+    t.m[2][2] = c + a.z()*a.z()*k;
+    return t;
+  }
+
+  // Composition: (*this * other)(p) == (*this)(other(p)).
+  affine_transform operator*(const affine_transform& other) const {
+    affine_transform t;
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 4; c++) {
+        t.m[r][c] = m[r][0]*other.m[0][c] + m[r][1]*other.m[1][c]
+                  + m[r][2]*other.m[2][c] + (c == 3 ? m[r][3] : 0.0);
+      }
+    }
+    return t;
+  }
+
+  point3 point(const point3& p) const {
+    return point3(
+      m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+      m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+      m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+  }
+
+  vec3<real> vector(const vec3<real>& v) const {
+    return vec3<real>(
+      m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+      m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+      m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+  }
+
+  // Multiplies by the transpose of the linear part. Called on the inverse
+  // transform this maps normals, which A itself would skew under non-uniform
+  // scaling.
+  vec3<real> transposed_vector(const vec3<real>& v) const {
+    return vec3<real>(
+      m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+      m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+      m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+  }
+
+  real determinant() const {
+    return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+         - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+         + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+  }
+
+  // Inverse by the adjugate; the transform must not be singular.
+  affine_transform inverse() const {
+    auto inv_det = 1.0 / determinant();
+
+    affine_transform t;
+    t.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+    t.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+    t.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+    t.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+    t.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+    t.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+    t.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+    t.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+    t.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+    auto b = t.vector(vec3<real>(m[0][3], m[1][3], m[2][3]));
+    for (int r = 0; r < 3; r++) t.m[r][3] = -b[r];
+    return t;
+  }
+
+  // Box around the transformed box: each output extent picks, per input
+  // axis, whichever end of the input interval contributes least (or most).
+  aabb bounds(const aabb& box) const {
+    interval out[3];
+    for (int r = 0; r < 3; r++) {
+      real lo = m[r][3], hi = m[r][3];
+      for (int c = 0; c < 3; c++) {
+        const auto& axis = box.axis_interval(c);
+        real a = m[r][c] * axis.min;
+        real b = m[r][c] * axis.max;
+        lo += std::fmin(a, b);
+        hi += std::fmax(a, b);
+      }
+      out[r] = interval(lo, hi);
+    }
+    return aabb(out[0], out[1], out[2]);
+  }
+};
+
+// One placement of shared geometry. The geometry, typically a bvh_node or a
+// triangle_mesh, acts as a bottom-level acceleration structure in its own
+// object space; a bvh_node over instances is the top level. Rays are moved
+// into object space with the cached inverse, so each instance costs two
+// matrices and a box no matter how large the geometry is. A material, if
+// given, replaces the geometry's own, so one mesh can be placed in several
+// materials.
+class instance : public hittable {
+ public:
+  instance(shared_ptr<hittable> geometry, const affine_transform& to_world,
+           shared_ptr<material> mat = nullptr)
+    : geometry(geometry), mat(mat), to_world(to_world),
+      to_object(to_world.inverse())
+  {
+    bbox = to_world.bounds(geometry->bounding_box());
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    // The direction is not renormalized, so t means the same in both spaces.
+    ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()),
+                 r.time());
+
+    if (!geometry->hit(object_r, ray_t, rec))
+      return false;
+
+    rec.p = to_world.point(rec.p);
+    rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+    if (mat) rec.mat = mat.get();
+
+    return true;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+ private:
+  shared_ptr<hittable> geometry;
+  shared_ptr<material> mat;
+  affine_transform to_world;
+  affine_transform to_object;
+  aabb bbox;
+};
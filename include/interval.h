@@ -4,30 +4,30 @@
 
 class interval {
  public:
-  double min, max;
+  real min, max;
 
   interval() : min(+infinity), max(-infinity) {}
 
-  interval(double min, double max) : min(min), max(max) {}
+  interval(real min, real max) : min(min), max(max) {}
 
   interval(const interval& a, const interval& b) {
     min = a.min <= b.min ? a.min : b.min;
     max = a.max >= b.max ? a.max : b.max;
   }
 
-  double size() const { return max - min; }
+  real size() const { return max - min; }
 
-  bool contains(double x) const { return min <= x && x <= max; }
+  bool contains(real x) const { return min <= x && x <= max; }
 
-  bool surrounds(double x) const { return min < x && x < max; };
+  bool surrounds(real x) const { return min < x && x < max; };
 
-  double clamp(double x) const {
+  real clamp(real x) const {
     if (x < min) return min;
     if (x > max) return max;
     return x;
   }
 
-  interval expand(double delta) const {
+  interval expand(real delta) const {
     auto padding = delta / 2.0;
     return interval(min - padding, max + padding);
   }
@@ -35,11 +35,11 @@ class interval {
   static const interval empty, universe;
 };
 
-inline interval operator+(const interval& ival, double displacement) {
+inline interval operator+(const interval& ival, real displacement) {
   return interval(ival.min + displacement, ival.max + displacement);
 }
 
-inline interval operator+(double displacement, const interval& ival) {
+inline interval operator+(real displacement, const interval& ival) {
   return ival + displacement;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hittable.h"
+#include "onb.h"
 #include "texture.h"
 
 class material {
@@ -12,10 +13,26 @@ class material {
     return false;
   }
 
-  virtual color emitted(double u, double v, const point3& p) const {
+  virtual color emitted(real u, real v, const point3& p) const {
     return color(0.0, 0.0, 0.0);
   }
 
+  // True when scatter() follows a delta or near-delta lobe (mirrors, glass)
+  // that light sampling cannot usefully hit; such vertices skip next-event
+  // estimation and eval()/scattering_pdf() are never called for them.
+  virtual bool is_specular() const { return true; }
+
+  // BSDF times the cosine term for scattering r_in into `direction`.
+  virtual color eval(const ray& r_in, const hit_record& rec,
+                     const vec3<real>& direction) const {
+    return color(0.0, 0.0, 0.0);
+  }
+
+  // Solid-angle density with which scatter() picks `direction`.
+  virtual real scattering_pdf(const ray& r_in, const hit_record& rec,
+                              const vec3<real>& direction) const {
+    return 0.0;
+  }
 };
 
 class lambertian : public material {
@@ -25,17 +42,30 @@ class lambertian : public material {
 
   bool scatter(const ray& r_in, const hit_record& rec,
                color& attenuation, ray& scattered) const override {
-    auto scatter_direction = rec.normal + random_unit_vector<double>();
-
-    if (scatter_direction.near_zero()) {
-      scatter_direction = rec.normal;
-    }
-
-    scattered = ray(rec.p, scatter_direction, r_in.time());
+    onb uvw(rec.normal);
+    scattered = rec.spawn(uvw.transform(random_cosine_direction()), r_in.time());
+    RT_STAT(texture_lookups);
     attenuation = tex->value(rec.u, rec.v, rec.p);
     return true;
   }
 
+  bool is_specular() const override { return false; }
+
+  color eval(const ray& r_in, const hit_record& rec,
+             const vec3<real>& direction) const override {
+    RT_STAT(texture_lookups);
+    return scattering_pdf(r_in, rec, direction) * tex->value(rec.u, rec.v, rec.p);
+  }
+
+  // scatter() draws a cosine-weighted direction in the hemisphere around the
+  // normal, built in an orthonormal basis from two sample values, so its
+  // density is cos(theta) / pi.
+  real scattering_pdf(const ray& r_in, const hit_record& rec,
+                      const vec3<real>& direction) const override {
+    auto cos_theta = dot(rec.normal, unit_vector(direction));
+    return cos_theta < 0 ? 0 : cos_theta / pi;
+  }
+
  private:
   shared_ptr<texture> tex;
   color albedo;
@@ -43,39 +73,39 @@ class lambertian : public material {
 
 class metal : public material {
  public:
-  metal(const color& albedo, double fuzz)
+  metal(const color& albedo, real fuzz)
       : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
   bool scatter(const ray &r_in, const hit_record &rec,
                color &attenuation, ray &scattered) const override {
-    vec3<double> reflected = reflect(r_in.direction(), rec.normal);
-    reflected = unit_vector(reflected) + (fuzz * random_unit_vector<double>());
-    scattered = ray(rec.p, reflected, r_in.time());
+    vec3<real> reflected = reflect(r_in.direction(), rec.normal);
+    reflected = unit_vector(reflected) + (fuzz * random_unit_vector<real>());
+    scattered = rec.spawn(reflected, r_in.time());
     attenuation = albedo;
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
  private:
   color albedo;
-  double fuzz;
+  real fuzz;
 };
 
 class dielectric : public material {
  public:
-  dielectric(double refraction_index) : refraction_index(refraction_index) {}
+  dielectric(real refraction_index) : refraction_index(refraction_index) {}
 
   bool scatter(const ray& r_in, const hit_record& rec,
                color& attenuation, ray& scattered) const override {
     attenuation = color(1.0, 1.0, 1.0);
 
-    double ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
+    real ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
 
-    vec3<double> unit_direction = unit_vector(r_in.direction());
-    double cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
-    double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+    vec3<real> unit_direction = unit_vector(r_in.direction());
+    real cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
+    real sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
 
     bool cannot_refract = ri * sin_theta > 1.0;
-    vec3<double> direction;
+    vec3<real> direction;
 
     if (cannot_refract || reflectance(cos_theta, ri) > random_double()) {
       direction = reflect(unit_direction, rec.normal);
@@ -83,14 +113,14 @@ class dielectric : public material {
       direction = refract(unit_direction, rec.normal, ri);
     }
 
-    scattered = ray(rec.p, direction, r_in.time());
+    scattered = rec.spawn(direction, r_in.time());
     return true;
   }
 
  private:
-  double refraction_index;
+  real refraction_index;
 
-  static double reflectance(double cosine, double refraction_index) {
+  static real reflectance(real cosine, real refraction_index) {
     auto r0 = (1 - refraction_index) / (1 + refraction_index);
     r0 = r0 * r0;
     return r0 + (1 - r0) * std::pow((1 - cosine), 5);
@@ -102,7 +132,8 @@ class diffuse_light : public material {
   diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
   diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
 
-  color emitted(double u, double v, const point3& p) const override {
+  color emitted(real u, real v, const point3& p) const override {
+    RT_STAT(texture_lookups);
     return tex->value(u, v, p);
   }
 
@@ -117,11 +148,25 @@ class isotropic : public material {
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
   const override {
-    scattered = ray(rec.p, random_unit_vector<double>(), r_in.time());
+    scattered = ray(rec.p, random_unit_vector<real>(), r_in.time());
+    RT_STAT(texture_lookups);
     attenuation = tex->value(rec.u, rec.v, rec.p);
     return true;
   }
 
+  bool is_specular() const override { return false; }
+
+  color eval(const ray& r_in, const hit_record& rec,
+             const vec3<real>& direction) const override {
+    RT_STAT(texture_lookups);
+    return scattering_pdf(r_in, rec, direction) * tex->value(rec.u, rec.v, rec.p);
+  }
+
+  real scattering_pdf(const ray& r_in, const hit_record& rec,
+                      const vec3<real>& direction) const override {
+    return 1 / (4 * pi);
+  }
+
  private:
   shared_ptr<texture> tex;
 };
@@ -0,0 +1,754 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+#include "triangle_mesh.h"
+
+// Read-only view of a whole file. It is memory-mapped on POSIX systems so
+// parsing starts without copying the file; elsewhere it is read into memory.
+class mapped_file {
+ public:
+  explicit mapped_file(const std::string& path) {
+#if defined(_WIN32)
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return;
+    buffer.resize(size_t(in.tellg()));
+    in.seekg(0);
+    if (!in.read(buffer.data(), buffer.size())) return;
+    bytes = buffer.data();
+    length = buffer.size();
+    open = true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      length = size_t(st.st_size);
+      if (length == 0) {
+        open = true;
+      } else {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+          madvise(p, length, MADV_WILLNEED);
+          bytes = static_cast<const char*>(p);
+          open = true;
+        }
+      }
+    }
+    ::close(fd);
+#endif
+  }
+
+  ~mapped_file() {
+#if !defined(_WIN32)
+    if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  bool is_open() const { return open; }
+  const char* data() const { return bytes; }
+  size_t size() const { return length; }
+
+ private:
+  const char* bytes = nullptr;
+  size_t length = 0;
+  bool open = false;
+#if defined(_WIN32)
+  std::vector<char> buffer;
+#endif
+};
+
+// Loads Wavefront OBJ and binary PLY files straight into mesh_data. Both
+// parsers work on the mapped bytes in parallel chunks and never allocate per
+// line; polygons are fan-triangulated. Errors are reported on std::cerr and
+// make load() return false.
+class mesh_loader {
+ public:
+  // Picks the parser from the file extension and reports the triangle count
+  // and load throughput on std::clog.
+  static bool load(const std::string& path, mesh_data& mesh) {
+    auto start = std::chrono::steady_clock::now();
+
+    mapped_file file(path);
+    if (!file.is_open()) {
+      std::cerr << "ERROR: Could not open mesh: " << path << "\n";
+      return false;
+    }
+
+    bool ok = false;
+    if (has_extension(path, ".obj")) {
+      ok = load_obj(file.data(), file.size(), mesh);
+    } else if (has_extension(path, ".ply")) {
+      ok = load_ply(file.data(), file.size(), mesh);
+    } else {
+      std::cerr << "ERROR: Unsupported mesh format: " << path << "\n";
+      return false;
+    }
+
+    if (!ok) {
+      std::cerr << "ERROR: Failed to load mesh: " << path << "\n";
+      return false;
+    }
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    double megabytes = file.size() / (1024.0 * 1024.0);
+    std::clog << "Loaded " << path << ": " << mesh.triangle_count()
+              << " triangles, " << mesh.positions.size() << " vertices ("
+              << megabytes << " MB in " << seconds * 1000 << " ms, "
+              << (seconds > 0 ? megabytes / seconds : 0.0) << " MB/s)\n";
+    return true;
+  }
+
+ private:
+  static constexpr size_t chunk_bytes = 4 << 20;
+  static constexpr uint32_t missing = ~0u;
+
+  static bool has_extension(const std::string& path, const char* ext) {
+    const size_t n = std::strlen(ext);
+    if (path.size() < n) return false;
+    for (size_t i = 0; i < n; i++) {
+      char c = path[path.size() - n + i];
+      if (c >= 'A' && c <= 'Z') c = char(c - 'A' + 'a');
+      if (c != ext[i]) return false;
+    }
+    return true;
+  }
+
+  // ---- OBJ ------------------------------------------------------------------
+
+  // Slice of the file between two line starts, and what parsing it produced.
+  struct obj_chunk {
+    const char* begin;
+    const char* end;
+    size_t positions = 0, normals = 0, uvs = 0;  // Counted in the first pass
+    std::vector<uint32_t> indices, normal_indices, uv_indices;
+    bool normals_match = true, uvs_match = true;
+    const char* error = nullptr;  // Start of the first malformed line
+  };
+
+  static bool is_space(char c) { return c == ' ' || c == '\t'; }
+
+  static const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+  }
+
+  static bool parse_float(const char*& p, const char* end, float& value) {
+    p = skip_space(p, end);
+    if (p < end && *p == '+') p++;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) return false;
+    p = result.ptr;
+    return true;
+  }
+
+  // OBJ indices are 1-based, or relative to the end of the list when negative.
+  static bool parse_index(const char*& p, const char* end, size_t count,
+                          uint32_t& index) {
+    long long value = 0;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc() || value == 0) return false;
+    p = result.ptr;
+    long long resolved = value > 0 ? value - 1 : (long long)(count) + value;
+    if (resolved < 0 || resolved >= (long long)(count)) return false;
+    index = uint32_t(resolved);
+    return true;
+  }
+
+  template <typename F>
+  static void for_each_line(const char* begin, const char* end, F&& line) {
+    for (const char* p = begin; p < end;) {
+      auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      const char* line_end = newline ? newline : end;
+      const char* trimmed = line_end;
+      if (trimmed > p && trimmed[-1] == '\r') trimmed--;
+      line(skip_space(p, trimmed), trimmed);
+      p = newline ? newline + 1 : end;
+    }
+  }
+
+  static bool load_obj(const char* data, size_t size, mesh_data& mesh) {
+    // Split at line boundaries into chunks of roughly chunk_bytes.
+    std::vector<obj_chunk> chunks;
+    const char* end = data + size;
+    for (const char* p = data; p < end;) {
+      const char* stop = p + std::min<size_t>(chunk_bytes, end - p);
+      if (stop < end) {
+        auto newline =
+            static_cast<const char*>(std::memchr(stop, '\n', end - stop));
+        stop = newline ? newline + 1 : end;
+      }
+      chunks.push_back({p, stop});
+      p = stop;
+    }
+
+    // First pass counts vertex records so every chunk knows where its
+    // vertices land in the shared arrays.
+    parallel_for(0, chunks.size(), 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; c++) {
+        auto& chunk = chunks[c];
+        for_each_line(chunk.begin, chunk.end, [&](const char* p, const char* q) {
+          if (q - p < 2 || p[0] != 'v') return;
+          if (is_space(p[1])) chunk.positions++;
+          else if (p[1] == 'n' && q - p > 2 && is_space(p[2])) chunk.normals++;
+          else if (p[1] == 't' && q - p > 2 && is_space(p[2])) chunk.uvs++;
+        });
+      }
+    });
+
+    std::vector<size_t> position_base(chunks.size() + 1, 0);
+    std::vector<size_t> normal_base(chunks.size() + 1, 0);
+    std::vector<size_t> uv_base(chunks.size() + 1, 0);
+    for (size_t c = 0; c < chunks.size(); c++) {
+      position_base[c + 1] = position_base[c] + chunks[c].positions;
+      normal_base[c + 1] = normal_base[c] + chunks[c].normals;
+      uv_base[c + 1] = uv_base[c] + chunks[c].uvs;
+    }
+    if (position_base.back() >= missing) {
+      std::cerr << "ERROR: OBJ has too many vertices\n";
+      return false;
+    }
+
+    mesh = mesh_data();
+    mesh.positions.resize(position_base.back());
+    mesh.normals.resize(normal_base.back());
+    mesh.uvs.resize(uv_base.back());
+
+    parallel_for(0, chunks.size(), 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; c++) {
+        parse_obj_chunk(chunks[c], position_base[c], normal_base[c],
+                        uv_base[c], mesh);
+      }
+    });
+
+    for (const auto& chunk : chunks) {
+      if (chunk.error) {
+        std::cerr << "ERROR: Malformed OBJ line at byte "
+                  << chunk.error - data << "\n";
+        return false;
+      }
+    }
+
+    return merge_obj_chunks(chunks, mesh);
+  }
+
+  static void parse_obj_chunk(obj_chunk& chunk, size_t position_base,
+                              size_t normal_base, size_t uv_base,
+                              mesh_data& mesh) {
+    size_t positions = position_base, normals = normal_base, uvs = uv_base;
+
+    for_each_line(chunk.begin, chunk.end, [&](const char* p, const char* q) {
+      if (chunk.error || p == q) return;
+      const char* line = p;
+
+      if (p[0] == 'v' && q - p > 1 && is_space(p[1])) {
+        float x, y, z;
+        p++;
+        if (!parse_float(p, q, x) || !parse_float(p, q, y) ||
+            !parse_float(p, q, z)) {
+          chunk.error = line;
+          return;
+        }
+        mesh.positions[positions++] = vec3<float>(x, y, z);
+      } else if (p[0] == 'v' && q - p > 2 && p[1] == 'n' && is_space(p[2])) {
+        float x, y, z;
+        p += 2;
+        if (!parse_float(p, q, x) || !parse_float(p, q, y) ||
+            !parse_float(p, q, z)) {
+          chunk.error = line;
+          return;
+        }
+        mesh.normals[normals++] = vec3<float>(x, y, z);
+      } else if (p[0] == 'v' && q - p > 2 && p[1] == 't' && is_space(p[2])) {
+        float u, v = 0;
+        p += 2;
+        if (!parse_float(p, q, u)) {
+          chunk.error = line;
+          return;
+        }
+        parse_float(p, q, v);
+        mesh.uvs[uvs++] = {u, v};
+      } else if (p[0] == 'f' && q - p > 1 && is_space(p[1])) {
+        if (!parse_obj_face(p + 1, q, positions, normals, uvs, chunk)) {
+          chunk.error = line;
+        }
+      }
+    });
+
+  }
+
+  // Parses `v`, `v/vt`, `v//vn` or `v/vt/vn` corners and fan-triangulates
+  // them. Vertex counts are those seen so far, for relative indices.
+  static bool parse_obj_face(const char* p, const char* q, size_t positions,
+                             size_t normals, size_t uvs, obj_chunk& chunk) {
+    uint32_t first[3], previous[3];
+    int corners = 0;
+
+    while (true) {
+      p = skip_space(p, q);
+      if (p == q) break;
+
+      uint32_t corner[3] = {missing, missing, missing};
+      if (!parse_index(p, q, positions, corner[0])) return false;
+      if (p < q && *p == '/') {
+        p++;
+        if (p < q && *p != '/' && !parse_index(p, q, uvs, corner[1]))
+          return false;
+        if (p < q && *p == '/') {
+          p++;
+          if (!parse_index(p, q, normals, corner[2])) return false;
+        }
+      }
+
+      if (corners >= 2) {
+        const uint32_t* triangle[3] = {first, previous, corner};
+        for (auto vertex : triangle) {
+          chunk.indices.push_back(vertex[0]);
+          chunk.uv_indices.push_back(vertex[1]);
+          chunk.normal_indices.push_back(vertex[2]);
+          chunk.uvs_match &= vertex[1] == vertex[0];
+          chunk.normals_match &= vertex[2] == vertex[0];
+        }
+      }
+
+      if (corners == 0) std::copy(corner, corner + 3, first);
+      std::copy(corner, corner + 3, previous);
+      corners++;
+    }
+
+    return corners >= 3 || corners == 0;
+  }
+
+  // Concatenates the per-chunk index buffers. Attribute index buffers that
+  // equal the position indices are dropped, and attributes that only some
+  // faces reference are discarded.
+  static bool merge_obj_chunks(std::vector<obj_chunk>& chunks,
+                               mesh_data& mesh) {
+    std::vector<size_t> base(chunks.size() + 1, 0);
+    bool normals_complete = true, uvs_complete = true;
+    bool normals_match = true, uvs_match = true;
+    for (size_t c = 0; c < chunks.size(); c++) {
+      const auto& chunk = chunks[c];
+      base[c + 1] = base[c] + chunk.indices.size();
+      normals_complete &= std::find(chunk.normal_indices.begin(),
+                                    chunk.normal_indices.end(),
+                                    missing) == chunk.normal_indices.end();
+      uvs_complete &= std::find(chunk.uv_indices.begin(),
+                                chunk.uv_indices.end(),
+                                missing) == chunk.uv_indices.end();
+      normals_match &= chunk.normals_match;
+      uvs_match &= chunk.uvs_match;
+    }
+
+    const bool keep_normals = !mesh.normals.empty() && normals_complete;
+    const bool keep_uvs = !mesh.uvs.empty() && uvs_complete;
+    if (!mesh.normals.empty() && !normals_complete) {
+      std::clog << "OBJ: not every face has normals, ignoring them\n";
+    }
+    if (!mesh.uvs.empty() && !uvs_complete) {
+      std::clog << "OBJ: not every face has texture coordinates, ignoring "
+                   "them\n";
+    }
+    if (!keep_normals) mesh.normals.clear();
+    if (!keep_uvs) mesh.uvs.clear();
+
+    mesh.indices.resize(base.back());
+    if (keep_normals && !normals_match) mesh.normal_indices.resize(base.back());
+    if (keep_uvs && !uvs_match) mesh.uv_indices.resize(base.back());
+
+    parallel_for(0, chunks.size(), 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; c++) {
+        auto& chunk = chunks[c];
+        std::copy(chunk.indices.begin(), chunk.indices.end(),
+                  mesh.indices.begin() + base[c]);
+        if (!mesh.normal_indices.empty()) {
+          std::copy(chunk.normal_indices.begin(), chunk.normal_indices.end(),
+                    mesh.normal_indices.begin() + base[c]);
+        }
+        if (!mesh.uv_indices.empty()) {
+          std::copy(chunk.uv_indices.begin(), chunk.uv_indices.end(),
+                    mesh.uv_indices.begin() + base[c]);
+        }
+        chunk = obj_chunk{chunk.begin, chunk.end};
+      }
+    });
+
+    return true;
+  }
+
+  // ---- Binary PLY -----------------------------------------------------------
+
+  enum class ply_type { none, int8, uint8, int16, uint16, int32, uint32,
+                        float32, float64 };
+
+  struct ply_property {
+    std::string name;
+    ply_type type = ply_type::none;
+    ply_type count_type = ply_type::none;  // Set for list properties
+  };
+
+  struct ply_element {
+    std::string name;
+    size_t count = 0;
+    std::vector<ply_property> properties;
+  };
+
+  static ply_type parse_ply_type(const std::string& name) {
+    if (name == "char" || name == "int8") return ply_type::int8;
+    if (name == "uchar" || name == "uint8") return ply_type::uint8;
+    if (name == "short" || name == "int16") return ply_type::int16;
+    if (name == "ushort" || name == "uint16") return ply_type::uint16;
+    if (name == "int" || name == "int32") return ply_type::int32;
+    if (name == "uint" || name == "uint32") return ply_type::uint32;
+    if (name == "float" || name == "float32") return ply_type::float32;
+    if (name == "double" || name == "float64") return ply_type::float64;
+    return ply_type::none;
+  }
+
+  static size_t type_size(ply_type type) {
+    switch (type) {
+      case ply_type::int8:  case ply_type::uint8:   return 1;
+      case ply_type::int16: case ply_type::uint16:  return 2;
+      case ply_type::int32: case ply_type::uint32:
+      case ply_type::float32:                       return 4;
+      case ply_type::float64:                       return 8;
+      default:                                      return 0;
+    }
+  }
+
+  static bool host_is_little_endian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+  }
+
+  template <typename T>
+  static T read_raw(const char* p, bool swap) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, p, sizeof(T));
+    if (swap) std::reverse(bytes, bytes + sizeof(T));
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+  }
+
+  static double read_value(const char* p, ply_type type, bool swap) {
+    switch (type) {
+      case ply_type::int8:    return read_raw<int8_t>(p, swap);
+      case ply_type::uint8:   return read_raw<uint8_t>(p, swap);
+      case ply_type::int16:   return read_raw<int16_t>(p, swap);
+      case ply_type::uint16:  return read_raw<uint16_t>(p, swap);
+      case ply_type::int32:   return read_raw<int32_t>(p, swap);
+      case ply_type::uint32:  return read_raw<uint32_t>(p, swap);
+      case ply_type::float32: return read_raw<float>(p, swap);
+      case ply_type::float64: return read_raw<double>(p, swap);
+      default:                return 0.0;
+    }
+  }
+
+  // Size of one record, or 0 if it contains list properties.
+  static size_t fixed_stride(const ply_element& element) {
+    size_t stride = 0;
+    for (const auto& property : element.properties) {
+      if (property.count_type != ply_type::none) return 0;
+      stride += type_size(property.type);
+    }
+    return stride;
+  }
+
+  // Walks records one by one to find where a variable-size element ends.
+  static bool skip_variable(const ply_element& element, const char*& p,
+                            const char* end, bool swap) {
+    for (size_t i = 0; i < element.count; i++) {
+      for (const auto& property : element.properties) {
+        if (property.count_type != ply_type::none) {
+          if (p + type_size(property.count_type) > end) return false;
+          auto n = size_t(read_value(p, property.count_type, swap));
+          p += type_size(property.count_type) + n * type_size(property.type);
+        } else {
+          p += type_size(property.type);
+        }
+        if (p > end) return false;
+      }
+    }
+    return true;
+  }
+
+  static bool parse_ply_header(const char* data, size_t size,
+                               std::vector<ply_element>& elements,
+                               bool& little_endian, size_t& header_size) {
+    static const char terminator[] = "end_header";
+    const char* end = data + size;
+    const char* found = std::search(data, end, terminator,
+                                    terminator + sizeof(terminator) - 1);
+    if (size < 4 || std::memcmp(data, "ply", 3) != 0 || found == end) {
+      std::cerr << "ERROR: Not a PLY file\n";
+      return false;
+    }
+    auto newline = static_cast<const char*>(
+        std::memchr(found, '\n', end - found));
+    if (!newline) return false;
+    header_size = size_t(newline + 1 - data);
+
+    std::istringstream header(std::string(data, header_size));
+    std::string line;
+    bool have_format = false;
+    while (std::getline(header, line)) {
+      std::istringstream words(line);
+      std::string keyword;
+      words >> keyword;
+
+      if (keyword == "format") {
+        std::string format;
+        words >> format;
+        if (format == "binary_little_endian") {
+          little_endian = true;
+        } else if (format == "binary_big_endian") {
+          little_endian = false;
+        } else {
+          std::cerr << "ERROR: Only binary PLY files are supported\n";
+          return false;
+        }
+        have_format = true;
+      } else if (keyword == "element") {
+        ply_element element;
+        words >> element.name >> element.count;
+        elements.push_back(element);
+      } else if (keyword == "property" && !elements.empty()) {
+        ply_property property;
+        std::string type;
+        words >> type;
+        if (type == "list") {
+          std::string count_type, item_type;
+          words >> count_type >> item_type;
+          property.count_type = parse_ply_type(count_type);
+          property.type = parse_ply_type(item_type);
+          if (property.count_type == ply_type::none) return false;
+        } else {
+          property.type = parse_ply_type(type);
+        }
+        if (property.type == ply_type::none) {
+          std::cerr << "ERROR: Unknown PLY property type: " << type << "\n";
+          return false;
+        }
+        words >> property.name;
+        elements.back().properties.push_back(property);
+      }
+    }
+    return have_format;
+  }
+
+  static bool load_ply(const char* data, size_t size, mesh_data& mesh) {
+    std::vector<ply_element> elements;
+    bool little_endian = true;
+    size_t header_size = 0;
+    if (!parse_ply_header(data, size, elements, little_endian, header_size))
+      return false;
+
+    const bool swap = little_endian != host_is_little_endian();
+    const char* end = data + size;
+    const char* p = data + header_size;
+
+    mesh = mesh_data();
+    for (const auto& element : elements) {
+      bool ok;
+      if (element.name == "vertex") {
+        ok = read_ply_vertices(element, p, end, swap, mesh);
+      } else if (element.name == "face") {
+        ok = read_ply_faces(element, p, end, swap, mesh);
+      } else if (size_t stride = fixed_stride(element)) {
+        ok = size_t(end - p) / stride >= element.count;
+        if (ok) p += element.count * stride;
+      } else {
+        ok = skip_variable(element, p, end, swap);
+      }
+
+      if (!ok) {
+        std::cerr << "ERROR: Truncated or malformed PLY element: "
+                  << element.name << "\n";
+        return false;
+      }
+    }
+
+    for (auto index : mesh.indices) {
+      if (index >= mesh.positions.size()) {
+        std::cerr << "ERROR: PLY face references a missing vertex\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool read_ply_vertices(const ply_element& element, const char*& p,
+                                const char* end, bool swap,
+                                mesh_data& mesh) {
+    const size_t stride = fixed_stride(element);
+    if (stride == 0 || size_t(end - p) / stride < element.count) return false;
+
+    // Byte offset and type of each attribute we keep, if present.
+    enum { X, Y, Z, NX, NY, NZ, U, V, attribute_count };
+    size_t offset[attribute_count];
+    ply_type type[attribute_count];
+    std::fill(type, type + attribute_count, ply_type::none);
+
+    size_t at = 0;
+    for (const auto& property : element.properties) {
+      const auto& n = property.name;
+      int slot = n == "x" ? X : n == "y" ? Y : n == "z" ? Z
+               : n == "nx" ? NX : n == "ny" ? NY : n == "nz" ? NZ
+               : (n == "u" || n == "s" || n == "texture_u" ||
+                  n == "texture_s") ? U
+               : (n == "v" || n == "t" || n == "texture_v" ||
+                  n == "texture_t") ? V
+               : -1;
+      if (slot >= 0) {
+        offset[slot] = at;
+        type[slot] = property.type;
+      }
+      at += type_size(property.type);
+    }
+    if (type[X] == ply_type::none || type[Y] == ply_type::none ||
+        type[Z] == ply_type::none) {
+      return false;
+    }
+
+    const bool has_normals = type[NX] != ply_type::none &&
+                             type[NY] != ply_type::none &&
+                             type[NZ] != ply_type::none;
+    const bool has_uvs = type[U] != ply_type::none && type[V] != ply_type::none;
+
+    mesh.positions.resize(element.count);
+    if (has_normals) mesh.normals.resize(element.count);
+    if (has_uvs) mesh.uvs.resize(element.count);
+
+    const char* base = p;
+    auto get = [&](const char* record, int slot) {
+      return float(read_value(record + offset[slot], type[slot], swap));
+    };
+    parallel_for(0, element.count, 1 << 16, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        const char* record = base + i * stride;
+        mesh.positions[i] =
+            vec3<float>(get(record, X), get(record, Y), get(record, Z));
+        if (has_normals) {
+          mesh.normals[i] =
+              vec3<float>(get(record, NX), get(record, NY), get(record, NZ));
+        }
+        if (has_uvs) mesh.uvs[i] = {get(record, U), get(record, V)};
+      }
+    });
+
+    p += element.count * stride;
+    return true;
+  }
+
+  // Faces are read in parallel on the assumption that every face is a
+  // triangle, which makes records fixed-size; anything else falls back to a
+  // sequential walk with fan triangulation.
+  static bool read_ply_faces(const ply_element& element, const char*& p,
+                             const char* end, bool swap, mesh_data& mesh) {
+    int list = -1, lists = 0;
+    size_t before = 0, after = 0;
+    for (size_t k = 0; k < element.properties.size(); k++) {
+      const auto& property = element.properties[k];
+      if (property.count_type != ply_type::none) {
+        lists++;
+        if (property.name == "vertex_indices" ||
+            property.name == "vertex_index") {
+          list = int(k);
+        }
+      } else {
+        (list < 0 ? before : after) += type_size(property.type);
+      }
+    }
+    if (list < 0) return false;
+
+    const auto& indices = element.properties[list];
+    const size_t count_size = type_size(indices.count_type);
+    const size_t index_size = type_size(indices.type);
+    const size_t stride = before + count_size + 3 * index_size + after;
+
+    if (lists == 1 && size_t(end - p) / stride >= element.count) {
+      mesh.indices.resize(3 * element.count);
+      std::atomic<bool> all_triangles = true;
+      const char* base = p;
+      parallel_for(0, element.count, 1 << 16, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e && all_triangles; i++) {
+          const char* record = base + i * stride + before;
+          if (read_value(record, indices.count_type, swap) != 3) {
+            all_triangles = false;
+            break;
+          }
+          record += count_size;
+          for (int k = 0; k < 3; k++) {
+            mesh.indices[3 * i + k] = uint32_t(
+                read_value(record + k * index_size, indices.type, swap));
+          }
+        }
+      });
+
+      if (all_triangles) {
+        p += element.count * stride;
+        return true;
+      }
+      mesh.indices.clear();
+    }
+
+    for (size_t i = 0; i < element.count; i++) {
+      for (size_t k = 0; k < element.properties.size(); k++) {
+        const auto& property = element.properties[k];
+        if (property.count_type == ply_type::none) {
+          p += type_size(property.type);
+          if (p > end) return false;
+          continue;
+        }
+
+        const size_t item_size = type_size(property.type);
+        if (p + type_size(property.count_type) > end) return false;
+        auto n = size_t(read_value(p, property.count_type, swap));
+        p += type_size(property.count_type);
+        if (size_t(end - p) / item_size < n) return false;
+
+        if (int(k) == list) {
+          uint32_t first = 0, previous = 0;
+          for (size_t c = 0; c < n; c++) {
+            auto index = uint32_t(read_value(p + c * item_size, property.type,
+                                             swap));
+            if (c == 0) first = index;
+            if (c >= 2) {
+              mesh.indices.push_back(first);
+              mesh.indices.push_back(previous);
+              mesh.indices.push_back(index);
+            }
+            previous = index;
+          }
+        }
+        p += n * item_size;
+      }
+    }
+    return true;
+  }
+};
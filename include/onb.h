@@ -0,0 +1,27 @@
+#pragma once
+
+#include "common.h"
+
+// Orthonormal basis whose w axis is aligned with a given direction.
+class onb {
+ public:
+  onb(const vec3<real>& n) {
+    axis[2] = unit_vector(n);
+    vec3<real> a = (std::fabs(axis[2].x()) > 0.9) ? vec3<real>(0, 1, 0)
+                                                    : vec3<real>(1, 0, 0);
+    axis[1] = unit_vector(cross(axis[2], a));
+    axis[0] = cross(axis[2], axis[1]);
+  }
+
+  const vec3<real>& u() const { return axis[0]; }
+  const vec3<real>& v() const { return axis[1]; }
+  const vec3<real>& w() const { return axis[2]; }
+
+  // Maps coordinates in this basis to world space.
+  vec3<real> transform(const vec3<real>& v) const {
+    return (v[0] * axis[0]) + (v[1] * axis[1]) + (v[2] * axis[2]);
+  }
+
+ private:
+  vec3<real> axis[3];
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+inline unsigned hardware_threads() {
+  const unsigned hw = std::thread::hardware_concurrency();
+  return hw ? hw : 1;
+}
+
+// Splits [begin, end) into at most `max_threads` contiguous chunks of at least
+// `grain` items and calls body(chunk_begin, chunk_end) for each of them
+// concurrently. Ranges shorter than two grains run on the calling thread.
+template <typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, unsigned max_threads,
+                  F&& body) {
+  const size_t count = end > begin ? end - begin : 0;
+  const size_t chunks =
+      std::min<size_t>(max_threads, grain ? count / grain : count);
+
+  if (chunks <= 1) {
+    if (count) body(begin, end);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(chunks - 1);
+  const size_t chunk_size = (count + chunks - 1) / chunks;
+  for (size_t c = 1; c < chunks; c++) {
+    size_t b = begin + c * chunk_size;
+    size_t e = std::min(end, b + chunk_size);
+    if (b < e) threads.emplace_back([&body, b, e] { body(b, e); });
+  }
+  body(begin, std::min(end, begin + chunk_size));
+
+  for (auto& t : threads) t.join();
+}
+
+template <typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, F&& body) {
+  parallel_for(begin, end, grain, hardware_threads(), std::forward<F>(body));
+}
@@ -5,7 +5,7 @@ class perlin {
  public:
   perlin() {
     for (int i = 0; i < point_count; i++) {
-      randvec[i] = unit_vector(vec3<double>::random(-1, 1));
+      randvec[i] = unit_vector(vec3<real>::random(-1, 1));
     }
 
     perlin_generate_perm(perm_x);
@@ -13,7 +13,7 @@ class perlin {
     perlin_generate_perm(perm_z);
   }
 
-  double noise(const point3& p) const {
+  real noise(const point3& p) const {
     auto u = p.x() - std::floor(p.x());
     auto v = p.y() - std::floor(p.y());
     auto w = p.z() - std::floor(p.z());
@@ -21,7 +21,7 @@ class perlin {
     auto i = int(std::floor(p.x()));
     auto j = int(std::floor(p.y()));
     auto k = int(std::floor(p.z()));
-    vec3<double> c[2][2][2];
+    vec3<real> c[2][2][2];
 
     for (int di = 0; di < 2; di++)
       for (int dj = 0; dj < 2; dj++)
@@ -35,7 +35,7 @@ class perlin {
     return trilinear_interp(c, u, v, w);  
   }
 
-  double turb(const point3& p, int depth) const {
+  real turb(const point3& p, int depth) const {
     auto accum = 0.0;
     auto temp_p = p;
     auto weight = 1.0;
@@ -51,7 +51,7 @@ class perlin {
 
  private:
   static const int point_count = 256;
-  vec3<double> randvec[point_count];
+  vec3<real> randvec[point_count];
   int perm_x[point_count];
   int perm_y[point_count];
   int perm_z[point_count];
@@ -72,11 +72,11 @@ class perlin {
     }
   }
 
-  static double trilinear_interp(
-    const vec3<double> c[2][2][2], 
-    double u, 
-    double v, 
-    double w) 
+  static real trilinear_interp(
+    const vec3<real> c[2][2][2], 
+    real u, 
+    real v, 
+    real w) 
   {
     auto uu = u * u * (3 - 2 * u);
     auto vv = v * v * (3 - 2 * v);
@@ -86,7 +86,7 @@ class perlin {
     for (int i = 0; i < 2; i++)
       for (int j = 0; j < 2; j++)
         for (int k = 0; k < 2; k++) {
-          vec3<double> weight_v(u - i, v - j, w - k);
+          vec3<real> weight_v(u - i, v - j, w - k);
           accum += (i * uu + (1 - i) * (1 - uu))
                  * (j * vv + (1 - j) * (1 - vv))
                  * (k * ww + (1 - k) * (1 - ww))
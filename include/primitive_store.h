@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+#include "constant_medium.h"
+#include "hittable.h"
+#include "quad.h"
+#include "sphere.h"
+#include "triangle.h"
+
+// Compiled form of a set of hittables: objects whose dynamic type is exactly
+// sphere, quad, triag or constant_medium are copied into one contiguous array
+// per type, everything else stays behind its shared_ptr. A type whose array
+// has run out of indices falls back to a shared_ptr too. A primitive is then
+// addressed by a 32-bit reference holding its kind and array index, and hit()
+// switches on the kind and calls the concrete hit() directly, so the common
+// primitive tests can be inlined instead of going through the vtable.
+class primitive_store {
+ public:
+  enum kind : uint32_t {
+    sphere_kind, quad_kind, triag_kind, medium_kind, other_kind
+  };
+
+  using ref = uint32_t;
+
+  static const int index_bits = 29;
+
+  // Copies `object` into the array for its type and returns its reference.
+  // Pass the last owner in by std::move so a copied primitive is not kept
+  // twice.
+  ref add(shared_ptr<hittable> object) {
+    const hittable& h = *object;
+    const auto& type = typeid(h);
+
+    if (type == typeid(sphere) && spheres.size() <= index_mask) {
+      spheres.push_back(static_cast<const sphere&>(h));
+      return make_ref(sphere_kind, spheres.size() - 1);
+    }
+    if (type == typeid(quad) && quads.size() <= index_mask) {
+      quads.push_back(static_cast<const quad&>(h));
+      return make_ref(quad_kind, quads.size() - 1);
+    }
+    if (type == typeid(triag) && triags.size() <= index_mask) {
+      triags.push_back(static_cast<const triag&>(h));
+      return make_ref(triag_kind, triags.size() - 1);
+    }
+    if (type == typeid(constant_medium) && media.size() <= index_mask) {
+      media.push_back(static_cast<const constant_medium&>(h));
+      return make_ref(medium_kind, media.size() - 1);
+    }
+    assert(others.size() <= index_mask);
+    others.push_back(std::move(object));
+    return make_ref(other_kind, others.size() - 1);
+  }
+
+  bool hit(ref p, const ray& r, interval ray_t, hit_record& rec) const {
+    const uint32_t i = p & index_mask;
+    switch (p >> index_bits) {
+      case sphere_kind: return spheres[i].sphere::hit(r, ray_t, rec);
+      case quad_kind:   return quads[i].quad::hit(r, ray_t, rec);
+      case triag_kind:  return triags[i].triag::hit(r, ray_t, rec);
+      case medium_kind: return media[i].constant_medium::hit(r, ray_t, rec);
+      default:          return others[i]->hit(r, ray_t, rec);
+    }
+  }
+
+  size_t sphere_count() const { return spheres.size(); }
+  size_t quad_count() const { return quads.size(); }
+  size_t triag_count() const { return triags.size(); }
+  size_t medium_count() const { return media.size(); }
+  size_t other_count() const { return others.size(); }
+
+ private:
+  static const uint32_t index_mask = (1u << index_bits) - 1;
+
+  std::vector<sphere> spheres;
+  std::vector<quad> quads;
+  std::vector<triag> triags;
+  std::vector<constant_medium> media;
+  std::vector<shared_ptr<hittable>> others;
+
+  static ref make_ref(kind k, size_t index) {
+    return (uint32_t(k) << index_bits) | uint32_t(index);
+  }
+};
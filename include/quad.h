@@ -7,8 +7,8 @@ class quad : public hittable {
  public:
   quad(
     const point3& Q,
-    const vec3<double>& u,
-    const vec3<double>& v,
+    const vec3<real>& u,
+    const vec3<real>& v,
     shared_ptr<material> mat) 
   : Q(Q), u(u), v(v), mat(mat)
   {
@@ -16,6 +16,7 @@ class quad : public hittable {
     normal = unit_vector(n);
     D = dot(normal, Q);
     w = n / dot(n, n);
+    area = n.length();
 
     set_bounding_box();
   }
@@ -29,6 +30,7 @@ class quad : public hittable {
   aabb bounding_box() const override { return bbox; }
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RT_STAT(quad_tests);
     auto denom = dot(normal, r.direction());
 
     if (std::fabs(denom) < 1e-8)
@@ -39,7 +41,7 @@ class quad : public hittable {
       return false;
 
     auto intersection = r.at(t);
-    vec3<double> planar_hitpt_vector = intersection - Q;
+    vec3<real> planar_hitpt_vector = intersection - Q;
     auto alpha = dot(w, cross(planar_hitpt_vector, v));
     auto beta = dot(w, cross(u, planar_hitpt_vector));
 
@@ -48,13 +50,30 @@ class quad : public hittable {
 
     rec.t = t;
     rec.p = intersection;
-    rec.mat = mat;
+    rec.mat = mat.get();
     rec.set_face_normal(r, normal);
 
     return true;
   }
 
-  virtual bool is_interior(double a, double b, hit_record& rec) const {
+  real pdf_value(const point3& origin,
+                 const vec3<real>& direction) const override {
+    hit_record rec;
+    if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+      return 0;
+
+    auto distance_squared = rec.t * rec.t * direction.length_squared();
+    auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+
+    return distance_squared / (cosine * area);
+  }
+
+  vec3<real> random(const point3& origin) const override {
+    auto p = Q + (random_double() * u) + (random_double() * v);
+    return p - origin;
+  }
+
+  virtual bool is_interior(real a, real b, hit_record& rec) const {
     interval unit_interval = interval(0.0, 1.0);
     if (!unit_interval.contains(a) || !unit_interval.contains(b))
       return false;
@@ -66,12 +85,13 @@ class quad : public hittable {
 
  private:
   point3 Q;
-  vec3<double> u, v;
-  vec3<double> w;
+  vec3<real> u, v;
+  vec3<real> w;
   shared_ptr<material> mat;
   aabb bbox;
-  vec3<double> normal;
-  double D;
+  vec3<real> normal;
+  real D;
+  real area;
 };
 
 inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat) {
@@ -80,9 +100,9 @@ inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_pt
   auto min = point3(std::fmin(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
   auto max = point3(std::fmax(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
 
-  auto dx = vec3<double>(max.x() - min.x(), 0.0, 0.0);
-  auto dy = vec3<double>(0.0, max.y() - min.y(), 0.0);
-  auto dz = vec3<double>(0.0, 0.0, max.z() - min.z());
+  auto dx = vec3<real>(max.x() - min.x(), 0.0, 0.0);
+  auto dy = vec3<real>(0.0, max.y() - min.y(), 0.0);
+  auto dz = vec3<real>(0.0, 0.0, max.z() - min.z());
 
   sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
   sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
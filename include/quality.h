@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Error of an image against a reference of the same size, both RGB.
+struct image_error {
+  double rmse = 0;
+  double relmse = 0;  // Squared error relative to the reference's squared
+                      // value, so dark and bright scenes weigh alike
+};
+
+inline image_error compare_images(const std::vector<float>& image,
+                                  const std::vector<float>& reference) {
+  // Keeps black reference pixels from dominating the relative error.
+  const double epsilon = 1e-2;
+
+  image_error error;
+  const size_t n = std::min(image.size(), reference.size());
+  if (n == 0) return error;
+
+  double sum_squared = 0, sum_relative = 0;
+  for (size_t i = 0; i < n; i++) {
+    const double r = reference[i];
+    const double d = double(image[i]) - r;
+    sum_squared += d * d;
+    sum_relative += d * d / (r * r + epsilon);
+  }
+  error.rmse = std::sqrt(sum_squared / n);
+  error.relmse = sum_relative / n;
+  return error;
+}
+
+// One render of a time-to-quality sweep.
+struct quality_sample {
+  int spp = 0;
+  double seconds = 0;  // Wall-clock, including denoising
+  image_error error;
+};
+
+// Seconds until `error_of(sample)` first reaches `target`, interpolated
+// linearly in log-log space between the samples around it, which is where
+// Monte Carlo error falls on a straight line. `samples` must be in order of
+// time. Returns -1 if no sample reaches the target.
+template <typename F>
+double time_to_error(const std::vector<quality_sample>& samples, double target,
+                     F&& error_of) {
+  for (size_t k = 0; k < samples.size(); k++) {
+    const double e1 = error_of(samples[k]);
+    if (e1 > target) continue;
+    if (k == 0) return samples[0].seconds;
+
+    const double e0 = error_of(samples[k - 1]);
+    const double t0 = samples[k - 1].seconds, t1 = samples[k].seconds;
+    if (e1 <= 0 || e0 <= e1 || t0 <= 0 || t1 <= t0) return t1;
+    const double f = std::log(e0 / target) / std::log(e0 / e1);
+    return t0 * std::pow(t1 / t0, f);
+  }
+  return -1;
+}
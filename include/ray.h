@@ -1,26 +1,46 @@
 #pragma once
 
+#include <cstdint>
+
 #include "vec3.h"
 
 class ray {
  public:
   ray() {}
 
-  ray(const point3& origin, const vec3<double>& direction, double time)
-      : orig(origin), dir(direction), tm(time) {};
+  ray(const point3& origin, const vec3<real>& direction, real time)
+      : orig(origin),
+        dir(direction),
+        inv_dir(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z()),
+        tm(time) {};
 
-  ray(const point3& origin, const vec3<double>& direction)
+  ray(const point3& origin, const vec3<real>& direction)
       : ray(origin, direction, 0.0) {}
 
   const point3& origin() const { return orig; }
-  const vec3<double>& direction() const { return dir; }
+  const vec3<real>& direction() const { return dir; }
+  const vec3<real>& inverse_direction() const { return inv_dir; }
   
-  double time() const { return tm; }
+  real time() const { return tm; }
 
-  point3 at(double t) const { return orig + t * dir; }
+  point3 at(real t) const { return orig + t * dir; }
 
  private:
   point3 orig;
-  vec3<double> dir;
-  double tm;
+  vec3<real> dir;
+  vec3<real> inv_dir;
+  real tm;
+};
+
+// Rays traced together through the scene. Lanes in `active` are traced
+// against [t_min, t_max[lane]]; a lane that finds a closer hit has its
+// t_max lowered to the hit distance and its bit set in `hit`.
+struct ray_packet {
+  static const int size = 8;
+
+  ray rays[size];
+  real t_max[size];
+  real t_min = 0;
+  uint32_t active = 0;
+  uint32_t hit = 0;
 };
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Counters of the work behind a render. Each thread counts into its own
+// cache-line aligned block and the render workers add theirs up when they
+// finish. The counting macros only do anything in builds configured with
+// -DRAYTRACER_STATS=ON; otherwise they expand to nothing.
+enum class stat_counter {
+  camera_rays,
+  shadow_rays,
+  bvh_nodes,       // Interior nodes visited, once per packet with --packets
+  aabb_tests,      // Child boxes tested, four per visited node
+  sphere_tests,
+  quad_tests,
+  triangle_tests,  // Triangles and mesh triangles
+  medium_queries,  // Boundary hit() calls of constant_medium
+  texture_lookups,
+  max_depth_paths,  // Paths that would have gone on but hit max_depth
+  count
+};
+
+struct alignas(64) render_stats {
+  // Bounce rays are counted by depth; the last bucket takes every deeper one.
+  static const int depth_buckets = 16;
+
+  uint64_t counters[int(stat_counter::count)] = {};
+  uint64_t bounce_rays[depth_buckets] = {};
+
+  uint64_t operator[](stat_counter c) const { return counters[int(c)]; }
+
+  void add(const render_stats& other) {
+    for (int c = 0; c < int(stat_counter::count); c++) {
+      counters[c] += other.counters[c];
+    }
+    for (int d = 0; d < depth_buckets; d++) {
+      bounce_rays[d] += other.bounce_rays[d];
+    }
+  }
+
+  uint64_t total_bounce_rays() const {
+    uint64_t total = 0;
+    for (int d = 0; d < depth_buckets; d++) total += bounce_rays[d];
+    return total;
+  }
+
+  // One line per counter, with the BVH work also per traced ray.
+  void print(std::ostream& out) const {
+    const uint64_t rays = counters[int(stat_counter::camera_rays)] +
+                          counters[int(stat_counter::shadow_rays)] +
+                          total_bounce_rays();
+    out << "Statistics:\n" << std::setfill(' ');
+    for (int c = 0; c < int(stat_counter::count); c++) {
+      out << "  " << std::left << std::setw(25) << label(stat_counter(c))
+          << std::right << counters[c];
+      const bool per_ray = stat_counter(c) == stat_counter::bvh_nodes ||
+                           stat_counter(c) == stat_counter::aabb_tests;
+      if (per_ray && rays > 0) {
+        out << " (" << std::fixed << std::setprecision(1)
+            << double(counters[c]) / rays << " per ray)";
+      }
+      out << "\n";
+      if (stat_counter(c) == stat_counter::shadow_rays) {
+        out << "  " << std::left << std::setw(25) << "bounce rays"
+            << std::right << total_bounce_rays() << " (by depth:";
+        for (int d = 0; d < last_used_depth(); d++) {
+          out << " " << bounce_rays[d];
+        }
+        out << ")\n";
+      }
+    }
+  }
+
+  bool write_json(const std::string& path) const {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+      std::cerr << "ERROR: Could not write stats: " << path << "\n";
+      return false;
+    }
+    std::fprintf(f, "{\n");
+    for (int c = 0; c < int(stat_counter::count); c++) {
+      std::fprintf(f, "  \"%s\": %llu,\n", key(stat_counter(c)),
+                   static_cast<unsigned long long>(counters[c]));
+    }
+    std::fprintf(f, "  \"bounce_rays_by_depth\": [");
+    for (int d = 0; d < last_used_depth(); d++) {
+      std::fprintf(f, "%s%llu", d > 0 ? ", " : "",
+                   static_cast<unsigned long long>(bounce_rays[d]));
+    }
+    std::fprintf(f, "]\n}\n");
+    if (std::fclose(f) != 0) {
+      std::cerr << "ERROR: Could not write stats: " << path << "\n";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  int last_used_depth() const {
+    int n = depth_buckets;
+    while (n > 0 && bounce_rays[n - 1] == 0) n--;
+    return n;
+  }
+
+  static const char* key(stat_counter c) {
+    switch (c) {
+      case stat_counter::camera_rays:      return "camera_rays";
+      case stat_counter::shadow_rays:      return "shadow_rays";
+      case stat_counter::bvh_nodes:        return "bvh_nodes";
+      case stat_counter::aabb_tests:       return "aabb_tests";
+      case stat_counter::sphere_tests:     return "sphere_tests";
+      case stat_counter::quad_tests:       return "quad_tests";
+      case stat_counter::triangle_tests:   return "triangle_tests";
+      case stat_counter::medium_queries:   return "medium_queries";
+      case stat_counter::texture_lookups:  return "texture_lookups";
+      case stat_counter::max_depth_paths:  return "max_depth_paths";
+      default:                             return "";
+    }
+  }
+
+  static std::string label(stat_counter c) {
+    std::string s = key(c);
+    std::replace(s.begin(), s.end(), '_', ' ');
+    if (c == stat_counter::bvh_nodes) s.replace(0, 3, "BVH");
+    if (c == stat_counter::aabb_tests) s.replace(0, 4, "AABB");
+    return s;
+  }
+};
+
+#if defined(RAYTRACER_STATS)
+const bool render_stats_enabled = true;
+#else
+const bool render_stats_enabled = false;
+#endif
+
+// Counters of the calling thread.
+inline render_stats& thread_stats() {
+  thread_local render_stats stats;
+  return stats;
+}
+
+#if defined(RAYTRACER_STATS)
+#define RT_STAT_ADD(counter, n) \
+  (thread_stats().counters[int(stat_counter::counter)] += (n))
+#define RT_STAT(counter) RT_STAT_ADD(counter, 1)
+// A ray leaving the `depth`th surface of a path, counting from 1.
+#define RT_STAT_BOUNCE(depth)                                      \
+  (++thread_stats().bounce_rays[std::min(int(depth),               \
+                                         render_stats::depth_buckets) - 1])
+#else
+#define RT_STAT_ADD(counter, n) ((void)0)
+#define RT_STAT(counter) ((void)0)
+#define RT_STAT_BOUNCE(depth) ((void)0)
+#endif
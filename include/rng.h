@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <thread>
+
+// PCG32 (O'Neill, XSH-RR output): 64 bits of state, 32-bit outputs, and
+// independent streams selected by `stream`. A draw is one multiply-add and
+// a rotate, far cheaper than mt19937_64 behind a distribution object.
+class pcg32 {
+ public:
+  pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+  pcg32(uint64_t state, uint64_t stream) { seed(state, stream); }
+
+  void seed(uint64_t initial_state, uint64_t stream) {
+    state = 0;
+    increment = (stream << 1) | 1;
+    next_uint();
+    state += initial_state;
+    next_uint();
+  }
+
+  uint32_t next_uint() {
+    const uint64_t old = state;
+    state = old * 0x5851f42d4c957f2dULL + increment;
+    const uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    const uint32_t rotation = uint32_t(old >> 59);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+  }
+
+  // Uniform in [0, 1) with the full 53 bits of a double.
+  double next_double() {
+    const uint64_t bits = (uint64_t(next_uint()) << 32) | next_uint();
+    return double(bits >> 11) * 0x1.0p-53;
+  }
+
+ private:
+  uint64_t state;
+  uint64_t increment;
+};
+
+// Finalizer of splitmix64; turns structured keys such as pixel coordinates
+// into well-distributed seeds.
+inline uint64_t mix_bits(uint64_t v) {
+  v ^= v >> 31;
+  v *= 0x7fb5d329728ea185ULL;
+  v ^= v >> 27;
+  v *= 0x81dadef4bc2dd44dULL;
+  v ^= v >> 33;
+  return v;
+}
+
+// Generator of the calling thread, seeded once from the OS and thread id.
+inline pcg32& thread_rng() {
+  thread_local pcg32 rng([] {
+    std::random_device rd;
+    const uint64_t seed = (uint64_t(rd()) << 32) ^ uint64_t(rd());
+    const uint64_t stream =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return pcg32(seed, mix_bits(stream));
+  }());
+  return rng;
+}
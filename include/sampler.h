@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "rng.h"
+
+// Source of the sample values of a pixel. `stratified` jitters a grid over
+// the pixel and draws everything else independently; `independent` drops
+// the grid. `sobol` and `blue_noise` feed every random decision along the
+// path from a low-discrepancy sequence, see pixel_sampler.
+enum class sampler_type { independent, stratified, sobol, blue_noise };
+
+// Low-discrepancy values for one sample of one pixel, handed out one
+// dimension per random_double() call. Dimensions come in pairs: pair k is
+// point `index` of the two-dimensional Sobol (0,2)-sequence, Owen-scrambled
+// with seeds derived from k, so each two-value decision (pixel offset, lens
+// position, direction) is stratified on its own ("padded" sampling).
+//
+// With `sobol` the sample index is also shuffled by a per-pixel Owen
+// permutation, which decorrelates the pixels. With `blue_noise` every pixel
+// walks the same sequence, shifted by a blue-noise mask (Cranley-Patterson
+// rotation), so the errors of neighbouring pixels are anti-correlated and
+// low sample counts show fine grain instead of blotches.
+//
+// Only the first max_dimensions values come from the sequence.
+class pixel_sampler {
+ public:
+  explicit pixel_sampler(sampler_type type, uint64_t seed = 0)
+    : type(type), seed_hash(mix_bits(seed))
+  {}
+
+  bool low_discrepancy() const {
+    return type == sampler_type::sobol || type == sampler_type::blue_noise;
+  }
+
+  // Starts sample `index` of pixel (i, j) at `dimension`.
+  void start(int i, int j, uint32_t index, uint32_t dimension = 0) {
+    pixel_x = i;
+    pixel_y = j;
+    pixel_hash =
+        mix_bits(seed_hash ^ ((uint64_t(uint32_t(i)) << 32) | uint32_t(j)));
+    sample_index = index;
+    next_dimension = dimension;
+    cached_pair = ~uint32_t(0);
+  }
+
+  uint32_t dimension() const { return next_dimension; }
+
+  double next() {
+    if (next_dimension >= max_dimensions) return thread_rng().next_double();
+    const uint32_t pair = next_dimension / 2;
+    const int component = next_dimension % 2;
+    next_dimension++;
+    if (pair != cached_pair) {
+      compute_pair(pair);
+      cached_pair = pair;
+    }
+    return values[component];
+  }
+
+ private:
+  static const int mask_size = 64;
+
+  // Dimensions past this many, about the camera ray and the first two
+  // bounces, are drawn from the thread's generator: deeper vertices gain
+  // little from stratification and a scrambled Sobol pair costs several
+  // times a PCG draw.
+  static const uint32_t max_dimensions = 16;
+
+  sampler_type type;
+  uint64_t seed_hash;
+  int pixel_x = 0, pixel_y = 0;
+  uint64_t pixel_hash = 0;
+  uint32_t sample_index = 0;
+  uint32_t next_dimension = 0;
+  uint32_t cached_pair = ~uint32_t(0);
+  double values[2] = {0, 0};
+
+  void compute_pair(uint32_t pair) {
+    const uint64_t key = seed_hash ^ (0x9e3779b97f4a7c15ULL * (pair + 1));
+    const uint64_t seed =
+        mix_bits(type == sampler_type::sobol ? pixel_hash ^ key : key);
+    const uint32_t y_seed = uint32_t((seed * 0xd1342543de82ef95ULL) >> 32);
+
+    uint32_t index = sample_index;
+    if (type == sampler_type::sobol) {
+      index = owen_scramble(index, uint32_t(seed));
+    }
+
+    // Owen scrambling of a Sobol point is a scramble of its bit-reversed
+    // index, so the first dimension scrambles `index` directly.
+    const uint32_t x = reverse_bits(laine_karras(index, uint32_t(seed >> 32)));
+    const uint32_t y =
+        reverse_bits(laine_karras(sobol_second_reversed(index), y_seed));
+    values[0] = x * 0x1.0p-32;
+    values[1] = y * 0x1.0p-32;
+
+    if (type == sampler_type::blue_noise) {
+      const auto& mask = blue_noise_mask();
+      for (int c = 0; c < 2; c++) {
+        const uint32_t shift = uint32_t(seed >> (16 * c));
+        const int mx = (pixel_x + int(shift & 0xff)) & (mask_size - 1);
+        const int my = (pixel_y + int((shift >> 8) & 0xff)) & (mask_size - 1);
+        const double v = values[c] + mask[my * mask_size + mx];
+        values[c] = v >= 1.0 ? v - 1.0 : v;
+      }
+    }
+  }
+
+  static uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+#if defined(__GNUC__)
+    return __builtin_bswap32(v);
+#else
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+#endif
+  }
+
+  // Second dimension of the Sobol sequence, whose generator matrix is the
+  // binary Pascal matrix, bit-reversed. The first dimension is the
+  // bit-reversed index.
+  static uint32_t sobol_second_reversed(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1; index; index >>= 1, v ^= v << 1) {
+      result ^= v & (0u - (index & 1));
+    }
+    return result;
+  }
+
+  // Hash in which every output bit depends only on the input bits below it
+  // (Burley's variant of Laine and Karras). On bit-reversed values that is
+  // a random nested permutation of the base-2 digits: an Owen scramble.
+  static uint32_t laine_karras(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+  }
+
+  static uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras(reverse_bits(x), seed));
+  }
+
+  // Values in [0, 1) ranked by void-and-cluster (Ulichney) on a torus, so
+  // any threshold of the mask is an evenly spread point set. Built on
+  // first use, which takes a few tens of milliseconds.
+  static const std::vector<float>& blue_noise_mask() {
+    static const std::vector<float> mask = build_blue_noise_mask();
+    return mask;
+  }
+
+  static std::vector<float> build_blue_noise_mask() {
+    const int n = mask_size;
+    const int count = n * n;
+    const double sigma = 1.5;
+
+    std::vector<double> kernel(count);
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        const int dx = std::min(x, n - x);
+        const int dy = std::min(y, n - y);
+        kernel[y * n + x] = std::exp(-(dx * dx + dy * dy) /
+                                     (2 * sigma * sigma));
+      }
+    }
+
+    std::vector<double> energy(count, 0.0);
+    std::vector<char> set(count, 0);
+    auto toggle = [&](int p) {
+      set[p] = !set[p];
+      const double sign = set[p] ? 1.0 : -1.0;
+      const int px = p % n, py = p / n;
+      for (int y = 0; y < n; y++) {
+        const double* row = &kernel[((y - py + n) % n) * n];
+        for (int x = 0; x < n; x++) {
+          energy[y * n + x] += sign * row[(x - px + n) % n];
+        }
+      }
+    };
+    // Tightest cluster: the set pixel with the most energy around it.
+    // Largest void: the empty pixel with the least.
+    auto extreme = [&](bool of_set) {
+      int best = -1;
+      for (int p = 0; p < count; p++) {
+        if (bool(set[p]) != of_set) continue;
+        if (best < 0 || (of_set ? energy[p] > energy[best]
+                                : energy[p] < energy[best]))
+          best = p;
+      }
+      return best;
+    };
+
+    // Initial pattern: random points relaxed by moving the tightest cluster
+    // into the largest void until that no longer changes anything.
+    pcg32 rng(0x5eed, 1);
+    const int initial = count / 10;
+    for (int placed = 0; placed < initial;) {
+      const int p = int(rng.next_uint() % count);
+      if (!set[p]) {
+        toggle(p);
+        placed++;
+      }
+    }
+    for (;;) {
+      const int cluster = extreme(true);
+      toggle(cluster);
+      const int hole = extreme(false);
+      toggle(hole);
+      if (hole == cluster) break;
+    }
+
+    std::vector<int> rank(count);
+    const auto initial_set = set;
+    const auto initial_energy = energy;
+
+    for (int r = initial - 1; r >= 0; r--) {
+      const int cluster = extreme(true);
+      toggle(cluster);
+      rank[cluster] = r;
+    }
+
+    set = initial_set;
+    energy = initial_energy;
+    for (int r = initial; r < count; r++) {
+      const int hole = extreme(false);
+      toggle(hole);
+      rank[hole] = r;
+    }
+
+    std::vector<float> mask(count);
+    for (int p = 0; p < count; p++) mask[p] = (rank[p] + 0.5f) / count;
+    return mask;
+  }
+};
+
+// Sampler that random_double() draws from on this thread, if any.
+inline thread_local pixel_sampler* active_sampler = nullptr;
+
+// Routes random_double() on this thread to `sampler` (nullptr for the
+// thread's generator) until the scope ends.
+class sampler_scope {
+ public:
+  explicit sampler_scope(pixel_sampler* sampler) : previous(active_sampler) {
+    active_sampler = sampler;
+  }
+  ~sampler_scope() { active_sampler = previous; }
+
+  sampler_scope(const sampler_scope&) = delete;
+  sampler_scope& operator=(const sampler_scope&) = delete;
+
+ private:
+  pixel_sampler* previous;
+};
@@ -1,54 +1,66 @@
 #pragma once
 
 #include "hittable.h"
+#include "onb.h"
 
 class sphere : public hittable {
  public:
   sphere(
     const point3& static_center, 
-    double radius, 
+    real radius, 
     std::shared_ptr<material> mat)
     : center(static_center, 
-      vec3<double>(0.0, 0.0, 0.0)), 
+      vec3<real>(0.0, 0.0, 0.0)), 
       radius(std::fmax(0, radius)), 
       mat(mat)
   {
-    auto rvec = vec3<double>(radius, radius, radius);
+    auto rvec = vec3<real>(radius, radius, radius);
     bbox = aabb(static_center - rvec, static_center + rvec);
   }
 
   sphere(
     const point3& center1, 
     const point3& center2, 
-    double radius, 
+    real radius, 
     std::shared_ptr<material> mat)
     : center(center1, center2 - center1), 
       radius(std::fmax(0, radius)), 
       mat(mat)
   {
-    auto rvec = vec3<double>(radius, radius, radius);
+    auto rvec = vec3<real>(radius, radius, radius);
     aabb box1(center.at(0) - rvec, center.at(0) + rvec);
     aabb box2(center.at(1) - rvec, center.at(1) + rvec);
     bbox = aabb(box1, box2);
   }
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RT_STAT(sphere_tests);
     point3 current_center = center.at(r.time());
-    vec3<double> oc = current_center - r.origin();
+    vec3<real> oc = current_center - r.origin();
     auto a = r.direction().length_squared();
     auto h = dot(r.direction(), oc);
     auto c = oc.length_squared() - radius * radius;
 
-    auto discriminant = h * h - a * c;
+    // h*h - a*c, computed from the distance between the center and the ray
+    // instead, which stays accurate in single precision for distant or large
+    // spheres.
+    auto perpendicular = oc - (h / a) * r.direction();
+    auto discriminant =
+        a * (radius * radius - perpendicular.length_squared());
     if (discriminant < 0) {
       return false;
     }
 
     auto sqrtd = std::sqrt(discriminant);
 
-    auto root = (h - sqrtd) / a;
+    // Both roots without subtracting nearly equal numbers.
+    auto q = h + std::copysign(sqrtd, h);
+    auto near_root = std::fmin(c / q, q / a);
+    auto far_root = std::fmax(c / q, q / a);
+
+    auto root = near_root;
     if (!ray_t.surrounds(root)) {
-      root = (h + sqrtd) / a;
+      root = far_root;
       if (!ray_t.surrounds(root)) {
         return false;
       }
@@ -59,19 +71,61 @@ class sphere : public hittable {
     vec3 outward_normal = (rec.p - current_center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat = mat;
+    rec.mat = mat.get();
     return true;
   }
 
   aabb bounding_box() const override { return bbox; }
 
+  // Light sampling picks directions uniformly inside the cone subtended by
+  // the sphere; origins inside it fall back to the whole sphere of directions.
+  // Moving spheres are sampled at their time-0 position.
+  real pdf_value(const point3& origin,
+                 const vec3<real>& direction) const override {
+    hit_record rec;
+    if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+      return 0;
+
+    auto dist_squared = (center.at(0) - origin).length_squared();
+    if (dist_squared <= radius * radius) return 1 / (4 * pi);
+
+    auto cos_theta_max = std::sqrt(1 - radius * radius / dist_squared);
+    auto solid_angle = 2 * pi * (1 - cos_theta_max);
+
+    return 1 / solid_angle;
+  }
+
+  vec3<real> random(const point3& origin) const override {
+    vec3<real> direction = center.at(0) - origin;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius * radius) {
+      return random_unit_vector<real>();
+    }
+
+    onb uvw(direction);
+    return uvw.transform(random_to_sphere(radius, distance_squared));
+  }
+
  private:
   ray center;
-  double radius;
+  real radius;
   std::shared_ptr<material> mat;
   aabb bbox;
 
-  static void get_sphere_uv(const point3& p, double& u, double& v) {
+  static vec3<real> random_to_sphere(real radius,
+                                     real distance_squared) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1);
+
+    auto phi = 2 * pi * r1;
+    auto x = std::cos(phi) * std::sqrt(1 - z * z);
+    auto y = std::sin(phi) * std::sqrt(1 - z * z);
+
+    return vec3<real>(x, y, z);
+  }
+
+  static void get_sphere_uv(const point3& p, real& u, real& v) {
     auto theta = std::acos(-p.y());
     auto phi = std::atan2(-p.z(), p.x()) + pi;
 
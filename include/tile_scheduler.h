@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Square block of pixels [x0, x1) x [y0, y1).
+struct tile {
+  int x0, y0, x1, y1;
+};
+
+// Splits an image into tiles that worker threads claim one at a time from a
+// shared atomic counter, so threads that land on cheap regions simply take
+// more tiles. Pixels inside a tile are visited in Morton (Z-curve) order to
+// keep consecutive primary rays close together.
+class tile_scheduler {
+ public:
+  struct pixel_offset {
+    int x, y;
+  };
+
+  tile_scheduler(int width, int height, int tile_size)
+      : tile_size(std::max(1, tile_size)) {
+    for (int y = 0; y < height; y += this->tile_size) {
+      for (int x = 0; x < width; x += this->tile_size) {
+        tiles.push_back({x, y, std::min(width, x + this->tile_size),
+                         std::min(height, y + this->tile_size)});
+      }
+    }
+
+    int side = 1;
+    while (side < this->tile_size) side *= 2;
+    for (uint32_t code = 0; code < uint32_t(side) * uint32_t(side); code++) {
+      pixel_offset p = {int(compact_bits(code)), int(compact_bits(code >> 1))};
+      if (p.x < this->tile_size && p.y < this->tile_size) order.push_back(p);
+    }
+  }
+
+  // Claims the next unrendered tile; returns false once all are taken.
+  bool next(tile& t) {
+    size_t index = next_tile++;
+    if (index >= tiles.size()) return false;
+    t = tiles[index];
+    return true;
+  }
+
+  void reset() { next_tile = 0; }
+
+  size_t tile_count() const { return tiles.size(); }
+
+  // Morton order of the offsets inside a full tile; offsets that fall outside
+  // a clipped edge tile must be skipped by the caller.
+  const std::vector<pixel_offset>& pixel_order() const { return order; }
+
+ private:
+  int tile_size;
+  std::vector<tile> tiles;
+  std::vector<pixel_offset> order;
+  std::atomic<size_t> next_tile = 0;
+
+  // Gathers the even bits of a Morton code.
+  static uint32_t compact_bits(uint32_t x) {
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0f0f0f0f;
+    x = (x | (x >> 4)) & 0x00ff00ff;
+    x = (x | (x >> 8)) & 0x0000ffff;
+    return x;
+  }
+};
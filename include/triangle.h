@@ -7,14 +7,12 @@ class triag : public hittable {
  public:
   triag(
     const point3& Q,
-    const vec3<double>& u,
-    const vec3<double>& v,
+    const vec3<real>& u,
+    const vec3<real>& v,
     shared_ptr<material> mat) 
   : Q(Q), u(u), v(v), mat(mat) 
   {
     normal = unit_vector(cross(u, v));
-    w = cross(u, normal);
-    D = dot(normal, Q);
 
     set_bounding_box();
   }
@@ -40,47 +38,40 @@ class triag : public hittable {
 
   aabb bounding_box() const override { return bbox; }
 
+  // Möller-Trumbore against the edges u and v; a and b are the barycentric
+  // coordinates along them.
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    auto denom = dot(normal, r.direction());
-    if (fabs(denom) < 1e-8) {
-        return false;
-    }
-
-    auto t = (D - dot(normal, r.origin())) / denom;
-    if (!ray_t.contains(t)) {
-        return false;
+    RT_STAT(triangle_tests);
+    auto pvec = cross(r.direction(), v);
+    auto det = dot(u, pvec);
+    if (det == 0.0) {
+      return false;
     }
+    auto inv_det = 1.0 / det;
 
-    auto p = r.at(t);
-    auto planar = p - Q;
+    auto tvec = r.origin() - Q;
+    real a = dot(tvec, pvec) * inv_det;
+    auto qvec = cross(tvec, u);
+    real b = dot(r.direction(), qvec) * inv_det;
 
-    auto uu = dot(u, u);
-    auto uv = dot(u, v);
-    auto vv = dot(v, v);
-    auto pu = dot(planar, u);
-    auto pv = dot(planar, v);
-
-    auto denom_ab = uu * vv - uv * uv;
-    if (fabs(denom_ab) < 1e-12) {
+    auto t = dot(v, qvec) * inv_det;
+    if (!ray_t.contains(t)) {
       return false;
     }
 
-    double a = (pu * vv - pv * uv) / denom_ab;
-    double b = (pv * uu - pu * uv) / denom_ab;
-
     if (!is_interior(a, b, rec)) {
       return false;
     }
 
     rec.t = t;
-    rec.p = p;
+    rec.p = r.at(t);
     rec.set_face_normal(r, normal);
-    rec.mat = mat;
+    rec.mat = mat.get();
 
     return true;
   }
 
-  virtual bool is_interior(double a, double b, hit_record& rec) const {
+  virtual bool is_interior(real a, real b, hit_record& rec) const {
     interval unit_interval(0.0, 1.0);
     if (a < 0 || b < 0 || a + b > 1)
       return false;
@@ -92,10 +83,8 @@ class triag : public hittable {
 
  private:
   point3 Q;
-  vec3<double> u, v;
-  vec3<double> w;
+  vec3<real> u, v;
   aabb bbox;
-  vec3<double> normal;
+  vec3<real> normal;
   shared_ptr<material> mat;
-  double D;
 };
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "hittable.h"
+#include "parallel.h"
+
+// Vertex and index buffers of an indexed triangle mesh. Vertex attributes are
+// stored in single precision; every triangle is three indices into them.
+// Normals and uvs are optional. When present they use their own index buffer
+// (as OBJ does), or `indices` if theirs is empty.
+struct mesh_data {
+  std::vector<vec3<float>>          positions;
+  std::vector<vec3<float>>          normals;
+  std::vector<std::array<float, 2>> uvs;
+
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> normal_indices;
+  std::vector<uint32_t> uv_indices;
+
+  size_t triangle_count() const { return indices.size() / 3; }
+};
+
+// A whole mesh as a single hittable. Triangles share the vertex buffers and
+// are intersected with Möller-Trumbore straight from them; an internal BVH
+// over triangle indices keeps hit() logarithmic in the triangle count.
+class triangle_mesh : public hittable {
+ public:
+  triangle_mesh(mesh_data data, shared_ptr<material> mat,
+                bvh_split split = bvh_split::sah)
+  : mesh(std::move(data)), mat(mat)
+  {
+    auto build_start = std::chrono::steady_clock::now();
+
+    const size_t count = mesh.triangle_count();
+    std::vector<aabb> bounds(count);
+    parallel_for(0, count, 1 << 14, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        point3 p0, p1, p2;
+        vertices(i, p0, p1, p2);
+        bounds[i] = aabb(aabb(p0, p1), aabb(p2, p2));
+      }
+    });
+
+    tree.build(bounds, split);
+    bbox = tree.bounds();
+    reorder(tree.primitive_order());
+
+    auto build_end = std::chrono::steady_clock::now();
+    build_ms =
+        std::chrono::duration<double, std::milli>(build_end - build_start)
+            .count();
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    uint32_t closest = 0;
+    real closest_t = 0, closest_a = 0, closest_b = 0;
+
+    // Only the nearest triangle's hit record is filled in, after traversal.
+    bool hit_anything = tree.hit(r, ray_t, [&](uint32_t i, interval& t) {
+      real hit_t, a, b;
+      if (!intersect(r, i, t, hit_t, a, b)) return false;
+      t.max = hit_t;
+      closest = i;
+      closest_t = hit_t;
+      closest_a = a;
+      closest_b = b;
+      return true;
+    });
+
+    if (!hit_anything) return false;
+
+    fill_record(r, closest, closest_t, closest_a, closest_b, rec);
+    return true;
+  }
+
+  void hit_packet(ray_packet& packet, hit_record* recs) const override {
+    uint32_t closest[ray_packet::size];
+    real closest_t[ray_packet::size];
+    real closest_a[ray_packet::size], closest_b[ray_packet::size];
+    const uint32_t already_hit = packet.hit;
+    packet.hit = 0;
+
+    tree.hit_packet(packet, [&](uint32_t i, int lane, interval& t) {
+      real hit_t, a, b;
+      if (!intersect(packet.rays[lane], i, t, hit_t, a, b)) return false;
+      t.max = hit_t;
+      closest[lane] = i;
+      closest_t[lane] = hit_t;
+      closest_a[lane] = a;
+      closest_b[lane] = b;
+      return true;
+    });
+
+    for (int lane = 0; lane < ray_packet::size; lane++) {
+      if (!(packet.hit & (1u << lane))) continue;
+      fill_record(packet.rays[lane], closest[lane], closest_t[lane],
+                  closest_a[lane], closest_b[lane], recs[lane]);
+    }
+    packet.hit |= already_hit;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  size_t triangle_count() const { return mesh.triangle_count(); }
+
+  // Wall-clock construction time of the internal BVH.
+  double build_time_ms() const { return build_ms; }
+  size_t node_count() const { return tree.node_count(); }
+
+ private:
+  mesh_data mesh;
+  shared_ptr<material> mat;
+  bvh_tree tree;
+  aabb bbox;
+  double build_ms = 0;
+
+  static point3 widen(const vec3<float>& v) {
+    return point3(v.x(), v.y(), v.z());
+  }
+
+  void vertices(size_t i, point3& p0, point3& p1, point3& p2) const {
+    p0 = widen(mesh.positions[mesh.indices[3 * i + 0]]);
+    p1 = widen(mesh.positions[mesh.indices[3 * i + 1]]);
+    p2 = widen(mesh.positions[mesh.indices[3 * i + 2]]);
+  }
+
+  // Stores the triangles in BVH leaf order so leaves address contiguous
+  // ranges of the index buffers.
+  void reorder(const std::vector<uint32_t>& order) {
+    auto permute = [&](std::vector<uint32_t>& buffer) {
+      if (buffer.empty()) return;
+      std::vector<uint32_t> sorted(buffer.size());
+      for (size_t i = 0; i < order.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+          sorted[3 * i + k] = buffer[3 * size_t(order[i]) + k];
+        }
+      }
+      buffer.swap(sorted);
+    };
+
+    permute(mesh.indices);
+    permute(mesh.normal_indices);
+    permute(mesh.uv_indices);
+  }
+
+  // Möller-Trumbore; (a, b) are the barycentric weights of vertices 1 and 2.
+  bool intersect(const ray& r, uint32_t i, const interval& ray_t,
+                 real& t, real& a, real& b) const {
+    RT_STAT(triangle_tests);
+    point3 p0, p1, p2;
+    vertices(i, p0, p1, p2);
+    const auto e1 = p1 - p0;
+    const auto e2 = p2 - p0;
+
+    const auto pvec = cross(r.direction(), e2);
+    const real det = dot(e1, pvec);
+    if (det == 0.0) return false;
+    const real inv_det = 1.0 / det;
+
+    const auto tvec = r.origin() - p0;
+    a = dot(tvec, pvec) * inv_det;
+    if (a < 0.0 || a > 1.0) return false;
+
+    const auto qvec = cross(tvec, e1);
+    b = dot(r.direction(), qvec) * inv_det;
+    if (b < 0.0 || a + b > 1.0) return false;
+
+    t = dot(e2, qvec) * inv_det;
+    return ray_t.surrounds(t);
+  }
+
+  void fill_record(const ray& r, uint32_t i, real t, real a, real b,
+                   hit_record& rec) const {
+    point3 p0, p1, p2;
+    vertices(i, p0, p1, p2);
+
+    const real c = 1.0 - a - b;
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.mat = mat.get();
+
+    // Facing is decided by the geometric normal; an interpolated shading
+    // normal is then flipped onto the same side.
+    const auto geometric = unit_vector(cross(p1 - p0, p2 - p0));
+    rec.set_face_normal(r, geometric);
+
+    if (!mesh.normals.empty()) {
+      const auto& n = mesh.normal_indices.empty() ? mesh.indices
+                                                  : mesh.normal_indices;
+      auto shading = unit_vector(c * widen(mesh.normals[n[3 * i + 0]]) +
+                                 a * widen(mesh.normals[n[3 * i + 1]]) +
+                                 b * widen(mesh.normals[n[3 * i + 2]]));
+      rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+    }
+
+    if (!mesh.uvs.empty()) {
+      const auto& n = mesh.uv_indices.empty() ? mesh.indices : mesh.uv_indices;
+      const auto& uv0 = mesh.uvs[n[3 * i + 0]];
+      const auto& uv1 = mesh.uvs[n[3 * i + 1]];
+      const auto& uv2 = mesh.uvs[n[3 * i + 2]];
+      rec.u = c * uv0[0] + a * uv1[0] + b * uv2[0];
+      rec.v = c * uv0[1] + a * uv1[1] + b * uv2[1];
+    } else {
+      rec.u = a;
+      rec.v = b;
+    }
+  }
+};
@@ -5,6 +5,16 @@
 
 #include "common.h"
 
+// Scalar arguments of the vec3 operators are not deduced, so mixing a vec3<T>
+// with a double literal converts the literal instead of failing deduction.
+template <typename T>
+struct vec3_scalar {
+  using type = T;
+};
+
+template <typename T>
+using vec3_scalar_t = typename vec3_scalar<T>::type;
+
 template <typename T>
 class vec3 {
  public:
@@ -28,14 +38,14 @@ class vec3 {
     return *this;
   }
 
-  constexpr vec3& operator*=(double t) {
+  constexpr vec3& operator*=(T t) {
     e[0] *= t;
     e[1] *= t;
     e[2] *= t;
     return *this;
   }
 
-  constexpr vec3& operator/=(double t) { return *this *= 1 / t; }
+  constexpr vec3& operator/=(T t) { return *this *= 1 / t; }
 
   constexpr T length_squared() const {
     return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
@@ -62,7 +72,7 @@ class vec3 {
   }
 };
 
-using point3 = vec3<double>;
+using point3 = vec3<real>;
 
 template <typename T>
 inline std::ostream& operator<<(std::ostream& out, const vec3<T>& v) {
@@ -85,17 +95,17 @@ constexpr inline vec3<T> operator*(const vec3<T>& u, const vec3<T>& v) {
 }
 
 template <typename T>
-constexpr inline vec3<T> operator*(double t, const vec3<T>& v) {
+constexpr inline vec3<T> operator*(vec3_scalar_t<T> t, const vec3<T>& v) {
   return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
 template <typename T>
-constexpr inline vec3<T> operator*(const vec3<T>& v, double t) {
+constexpr inline vec3<T> operator*(const vec3<T>& v, vec3_scalar_t<T> t) {
   return t * v;
 }
 
 template <typename T>
-constexpr inline vec3<T> operator/(const vec3<T>& v, double t) {
+constexpr inline vec3<T> operator/(const vec3<T>& v, vec3_scalar_t<T> t) {
   return (1 / t) * v;
 }
 
@@ -116,24 +126,48 @@ inline vec3<T> unit_vector(const vec3<T>& v) {
   return v / v.length();
 }
 
-inline vec3<double> random_in_unit_disk() {
-  while (true) {
-    auto p = vec3<double>(random_double(-1, 1), random_double(-1, 1), 0);
-      if (p.length_squared() < 1) {
-        return p;
-    }
-  }
+// Area-preserving maps from two uniform numbers in [0, 1). They take one
+// pair of values each and never reject, so stratified or low-discrepancy
+// input stays evenly spread over the output domain.
+
+template <typename T>
+inline vec3<T> disk_from_square(T u1, T u2) {
+  const T r = std::sqrt(u1);
+  const T phi = 2 * pi * u2;
+  return vec3<T>(r * std::cos(phi), r * std::sin(phi), 0);
+}
+
+template <typename T>
+inline vec3<T> sphere_from_square(T u1, T u2) {
+  const T z = 1 - 2 * u1;
+  const T r = std::sqrt(std::fmax(T(0), 1 - z * z));
+  const T phi = 2 * pi * u2;
+  return vec3<T>(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Cosine-weighted direction about +z.
+template <typename T>
+inline vec3<T> cosine_hemisphere_from_square(T u1, T u2) {
+  const T r = std::sqrt(u1);
+  const T phi = 2 * pi * u2;
+  return vec3<T>(r * std::cos(phi), r * std::sin(phi),
+                 std::sqrt(std::fmax(T(0), 1 - u1)));
+}
+
+inline vec3<real> random_in_unit_disk() {
+  const real u1 = random_double();
+  return disk_from_square<real>(u1, random_double());
 }
 
 template <typename T>
 inline vec3<T> random_unit_vector() {
-  while (true) {
-    auto p = vec3<T>::random(static_cast<T>(-1), static_cast<T>(1));
-    auto lensq = p.length_squared();
-    if (1e-160 < lensq && lensq <= static_cast<T>(1)) {
-      return p / std::sqrt(lensq);
-    }
-  }
+  const T u1 = static_cast<T>(random_double());
+  return sphere_from_square<T>(u1, static_cast<T>(random_double()));
+}
+
+inline vec3<real> random_cosine_direction() {
+  const real u1 = random_double();
+  return cosine_hemisphere_from_square<real>(u1, random_double());
 }
 
 template <typename T>
@@ -150,10 +184,10 @@ inline vec3<T> reflect(const vec3<T>& v, const vec3<T>& n) {
 
 template <typename T>
 inline vec3<T> refract(const vec3<T>& uv, const vec3<T>& n,
-                       double etai_over_etat) {
-  auto cos_theta = std::fmin(dot(-uv, n), 1.0);
+                       T etai_over_etat) {
+  auto cos_theta = std::fmin(dot(-uv, n), T(1));
   vec3<T> r_out_perp = etai_over_etat * (uv + cos_theta * n);
   vec3<T> r_out_parallel =
-      -std::sqrt(std::fabs(1.0 - r_out_perp.length_squared())) * n;
+      -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
   return r_out_perp + r_out_parallel;
 }
@@ -20,11 +20,25 @@ cpu_count() {
   fi
 }
 
+# True if the program arguments already pick a --seed.
+has_seed() {
+  local arg
+  for arg in "$@"; do
+    [[ "${arg}" == --seed=* ]] && return 0
+  done
+  return 1
+}
+
 usage() {
   cat <<'EOF'
 Usage:
   ./raytracer.sh build          [cmake-args...]
                  run            [program-args...]
+                 scaling        [scene] [program-args...]
+                 precision      [scene] [program-args...]
+                 samplers       [scene] [spp] [program-args...]
+                 quality        [scene...] [program-args...]
+                 bench          [bench-args...]
                  convert <file>
                  clean
                  help
@@ -61,6 +75,137 @@ case "${cmd}" in
     systemd-inhibit --what=sleep:shutdown:idle --why="Cpu render" -- "${BIN}" "$@"
     ;;
 
+  scaling)
+    # Renders one scene with 1, 2, 4, ... threads up to all cores and
+    # prints the ray throughput and speedup over one thread for each.
+    ensure_dirs
+    if [[ ! -x "${BIN}" ]]; then
+      echo "Binary not found at ${BIN}. Building first..."
+      cmake -S . -B "${BUILD_DIR}" -DCMAKE_BUILD_TYPE="${BUILD_TYPE}"
+      cmake --build "${BUILD_DIR}" -- -j"$(cpu_count)"
+    fi
+
+    scene="${1:-10}"; shift || true
+    # Every thread count renders the same scene layout.
+    has_seed "$@" || set -- "$@" --seed=1
+    max_threads="$(cpu_count)"
+    thread_counts=()
+    for ((t = 1; t < max_threads; t *= 2)); do thread_counts+=("${t}"); done
+    thread_counts+=("${max_threads}")
+
+    printf "%8s %12s %8s\n" "threads" "Mrays/s" "speedup"
+    base=""
+    for t in "${thread_counts[@]}"; do
+      rate="$("${BIN}" "${scene}" "$@" --threads="${t}" 2>/dev/null \
+        | sed -n 's/^Rays: .*(\([0-9.]*\) Mrays\/s)$/\1/p')"
+      base="${base:-${rate}}"
+      printf "%8s %12s %8s\n" "${t}" "${rate}" \
+        "$(awk -v r="${rate}" -v b="${base}" 'BEGIN { printf "%.2fx", r / b }')"
+    done
+    ;;
+
+  precision)
+    # Renders one scene with a double and a float build, then prints both
+    # timings and the difference between the two images.
+    ensure_dirs
+    FLOAT_BUILD_DIR="${BUILD_DIR}-float"
+    cmake -S . -B "${BUILD_DIR}" -DCMAKE_BUILD_TYPE="${BUILD_TYPE}" \
+      -DRAYTRACER_USE_FLOAT=OFF
+    cmake --build "${BUILD_DIR}" -- -j"$(cpu_count)"
+    cmake -S . -B "${FLOAT_BUILD_DIR}" -DCMAKE_BUILD_TYPE="${BUILD_TYPE}" \
+      -DRAYTRACER_USE_FLOAT=ON
+    cmake --build "${FLOAT_BUILD_DIR}" -- -j"$(cpu_count)"
+
+    scene="${1:-10}"; shift || true
+    # Both builds draw the scene layout from the seed, so they share one.
+    has_seed "$@" || set -- "$@" --seed=1
+    renders=()
+    for precision in double float; do
+      bin="${BIN}"
+      [[ "${precision}" == "float" ]] && bin="./${FLOAT_BUILD_DIR}/${BIN_NAME}"
+      log="$("${bin}" "${scene}" "$@" 2>/dev/null | tr '\r' '\n')"
+      echo "${precision}:"
+      echo "${log}" | grep -E '^(Done in|Rays:)' | sed 's/^/  /'
+      renders+=("$(echo "${log}" | sed -n 's/^Render path: //p')")
+    done
+
+    echo "float vs double:"
+    "${BIN}" diff "${renders[0]}" "${renders[1]}" | sed 's/^/  /'
+    ;;
+
+  samplers)
+    # Renders one scene with every sampler at the same sample count and
+    # prints the time and the error of each against a stratified reference
+    # with 16 times as many samples.
+    ensure_dirs
+    if [[ ! -x "${BIN}" ]]; then
+      echo "Binary not found at ${BIN}. Building first..."
+      cmake -S . -B "${BUILD_DIR}" -DCMAKE_BUILD_TYPE="${BUILD_TYPE}"
+      cmake --build "${BUILD_DIR}" -- -j"$(cpu_count)"
+    fi
+
+    scene="${1:-7}"; shift || true
+    spp="${1:-16}"; shift || true
+    # Every run draws the same scene layout; the reference takes its own
+    # samples so its noise does not correlate with the stratified run's.
+    has_seed "$@" || set -- "$@" --seed=1
+    seed="$(printf '%s\n' "$@" | sed -n 's/^--seed=//p' | tail -n 1)"
+
+    reference="${RENDERS_DIR}/samplers-reference.hdr"
+    echo "Rendering reference at $((spp * 16)) spp..."
+    "${BIN}" "${scene}" "$@" --spp="$((spp * 16))" --sampler=stratified \
+      --render-seed="$((seed + 1))" --output="${reference}" >/dev/null 2>&1
+
+    for sampler in independent stratified sobol blue-noise; do
+      render="${RENDERS_DIR}/samplers-${sampler}.hdr"
+      log="$("${BIN}" "${scene}" "$@" --spp="${spp}" --sampler="${sampler}" \
+        --output="${render}" 2>/dev/null | tr '\r' '\n')"
+      echo "${sampler}:"
+      echo "${log}" | grep -E '^Done in' | sed 's/^/  /'
+      "${BIN}" diff "${render}" "${reference}" | grep -E '^(RMSE|PSNR)' \
+        | sed 's/^/  /'
+    done
+    ;;
+
+  quality)
+    # Renders each scene at about doubling sample counts, writes the error
+    # against a high-spp reference over time to output/quality.csv and, with
+    # gnuplot installed, plots it to output/quality.png.
+    ensure_dirs
+    if [[ ! -x "${BIN}" ]]; then
+      echo "Binary not found at ${BIN}. Building first..."
+      cmake -S . -B "${BUILD_DIR}" -DCMAKE_BUILD_TYPE="${BUILD_TYPE}"
+      cmake --build "${BUILD_DIR}" -- -j"$(cpu_count)"
+    fi
+
+    csv="${RENDERS_DIR}/quality.csv"
+    "${BIN}" quality "$@" | tee "${csv}"
+
+    if command -v gnuplot >/dev/null 2>&1; then
+      scenes="$(tail -n +2 "${csv}" | cut -d, -f1 | sort -u | tr '\n' ' ')"
+      gnuplot <<EOF
+set terminal png size 900,600
+set output "${RENDERS_DIR}/quality.png"
+set datafile separator ","
+set logscale xy
+set xlabel "seconds"
+set ylabel "relMSE"
+plot for [s in "${scenes}"] "${csv}" \\
+  using 3:(strcol(1) eq s ? \$5 : 1/0) with linespoints title s
+EOF
+      echo "Plot: ${RENDERS_DIR}/quality.png"
+    fi
+    ;;
+
+  bench)
+    # Builds and runs the kernel microbenchmarks; JSON goes to stdout, or CSV
+    # with --scaling.
+    ensure_dirs
+    cmake -S . -B "${BUILD_DIR}" -DCMAKE_BUILD_TYPE="${BUILD_TYPE}"
+    cmake --build "${BUILD_DIR}" --target "${BIN_NAME}_bench" -- -j"$(cpu_count)"
+    "./${BUILD_DIR}/${BIN_NAME}_bench" "$@"
+    ;;
+
   convert)
     target="${1:-}"
     if [[ -z "${target}" ]]; then
@@ -82,7 +227,7 @@ case "${cmd}" in
     ;;
 
   clean)
-    rm -rf "${BUILD_DIR}"
+    rm -rf "${BUILD_DIR}" "${BUILD_DIR}-float"
     echo "Removed ${BUILD_DIR}/"
     rm -rf "${RENDERS_DIR}"
     echo "Removed ${RENDERS_DIR}/"
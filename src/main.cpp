@@ -4,15 +4,62 @@
 #include "constant_medium.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "instance.h"
 #include "material.h"
+#include "mesh_loader.h"
 #include "quad.h"
+#include "quality.h"
 #include "sphere.h"
 #include "texture.h"
 #include "triangle.h"
+#include "triangle_mesh.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+// Command line overrides shared by every scene.
+struct options {
+  bvh_split bvh = bvh_split::sah;
+  int threads = 0;
+  int tile_size = 16;
+  double adaptive_threshold = 0;
+  int min_spp = 16;
+  bool sample_map = false;
+  bool light_sampling = true;
+  bool packets = false;
+  sampler_type sampler = sampler_type::stratified;
+  int spp = 0;  // Overrides the scene's samples per pixel when set
+  int width = 0;  // Overrides the scene's image width when set
+  int64_t seed = -1;  // Scene generation and rendering; random when unset
+  int64_t render_seed = -1;  // Replaces seed for the samples only when set
+  int scene = 0;  // The scene being rendered, set by run_scene
+  std::string mesh_path;
+  std::string output;  // Replaces the timestamped output path when set
+  std::string checkpoint;
+  double checkpoint_interval = 300;
+  bool resume = false;
+  bool progressive = false;
+  double snapshot_interval = 10;
+  bool denoise = false;
+  bool heatmap = false;
+  bool heatmap_paths = false;
+  // `quality` mode: renders every scene against a reference instead.
+  bool quality = false;
+  int reference_spp = 4096;
+  double target_error = 0.01;  // relMSE
+  double max_seconds = 60;     // Stops a scene's sweep after a longer render
+} opts;
+
+// A scene's top-level BVH; its build time is printed, while nested BVHs
+// build silently.
+shared_ptr<bvh_node> build_bvh(hittable_list list) {
+  auto node = make_shared<bvh_node>(std::move(list), opts.bvh);
+  std::clog << "BVH built in " << node->build_time_ms() << " ms ("
+            << node->object_count() << " objects, " << node->node_count()
+            << " nodes)\n";
+  return node;
+}
+
 std::string timestamp(std::string s) {
   using namespace std::chrono;
   auto now = system_clock::now();
@@ -24,6 +71,47 @@ std::string timestamp(std::string s) {
   return "output/" + s + "-" + ss.str() + ".hdr";
 }
 
+void measure_quality(camera& cam, const hittable& world,
+                     const hittable_list& lights, const std::string& name);
+
+void render(camera& cam, const hittable& world, const hittable_list& lights,
+            const std::string& name) {
+  cam.num_threads = opts.threads;
+  cam.tile_size   = opts.tile_size;
+
+  cam.adaptive_threshold    = opts.adaptive_threshold;
+  cam.min_samples_per_pixel = opts.min_spp;
+  cam.write_sample_map      = opts.sample_map;
+  cam.packet_primary_rays   = opts.packets;
+  cam.sampler               = opts.sampler;
+  cam.seed                  = opts.render_seed >= 0 ? opts.render_seed
+                                                 : opts.seed;
+  cam.checkpoint_path       = opts.checkpoint;
+  cam.checkpoint_interval   = opts.checkpoint_interval;
+  cam.resume                = opts.resume;
+  cam.scene_id              = std::to_string(opts.scene) + " " + name + " " +
+                              std::to_string(opts.seed) + " " + opts.mesh_path;
+  cam.progressive           = opts.progressive;
+  cam.snapshot_interval     = opts.snapshot_interval;
+  cam.denoise               = opts.denoise;
+  cam.write_heatmap         = opts.heatmap;
+  cam.heatmap_paths         = opts.heatmap_paths;
+  if (opts.spp > 0) cam.samples_per_pixel = opts.spp;
+  if (opts.width > 0) cam.image_width = opts.width;
+
+  if (opts.quality) {
+    measure_quality(cam, world,
+                    opts.light_sampling ? lights : hittable_list(), name);
+    return;
+  }
+  cam.render(world, opts.light_sampling ? lights : hittable_list(),
+             opts.output.empty() ? timestamp(name) : opts.output);
+}
+
+void render(camera& cam, const hittable& world, const std::string& name) {
+  render(cam, world, hittable_list(), name);
+}
+
 void bouncing_spheres() {
   hittable_list world;
 
@@ -42,7 +130,7 @@ void bouncing_spheres() {
           // diffuse
           auto albedo = color::random() * color::random();
           sphere_material = make_shared<lambertian>(albedo);
-          auto center2 = center + vec3<double>(0.0, random_double(0.0, 0.5), 0.0);
+          auto center2 = center + vec3<real>(0.0, random_double(0.0, 0.5), 0.0);
           world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
         } else if (choose_mat < 0.95) {
           // metal
@@ -67,7 +155,7 @@ void bouncing_spheres() {
   auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
   world.add(make_shared<sphere>(point3(4.0, 1.0, 0.0), 1.0, material3));
 
-  world = hittable_list(make_shared<bvh_node>(world));
+  world = hittable_list(build_bvh(std::move(world)));
 
   camera cam;
 
@@ -81,12 +169,12 @@ void bouncing_spheres() {
   cam.vfov     = 20;
   cam.lookfrom = point3(13.0, 2.0, 3.0);
   cam.lookat   = point3(0.0, 0.0, 0.0);
-  cam.vup      = vec3<double>(0.0, 1.0, 0.0);
+  cam.vup      = vec3<real>(0.0, 1.0, 0.0);
 
   cam.defocus_angle = 0.6;
   cam.focus_dist    = 10.0;
 
-  cam.render(world, timestamp("motion-blur"));
+  render(cam, world, "motion-blur");
 }
 
 void checkered_spheres() {
@@ -97,7 +185,7 @@ void checkered_spheres() {
   world.add(make_shared<sphere>(point3(0.0, -10.0, 0.0), 10.0, make_shared<lambertian>(checker)));
   world.add(make_shared<sphere>(point3(0.0,  10.0, 0.0), 10.0, make_shared<lambertian>(checker)));
 
-  world = hittable_list(make_shared<bvh_node>(world));
+  world = hittable_list(build_bvh(std::move(world)));
 
   camera cam;
 
@@ -110,12 +198,12 @@ void checkered_spheres() {
   cam.vfov     = 20;
   cam.lookfrom = point3(13.0, 2.0, 3.0);
   cam.lookat   = point3(0.0, 0.0, 0.0);
-  cam.vup      = vec3<double>(0.0, 1.0, 0.0);
+  cam.vup      = vec3<real>(0.0, 1.0, 0.0);
 
   cam.defocus_angle = 0.6;
   cam.focus_dist    = 10.0;
 
-  cam.render(world, timestamp("checkered-spheres"));
+  render(cam, world, "checkered-spheres");
 }
 
 void earth() {
@@ -134,11 +222,11 @@ void earth() {
   cam.vfov     = 20;
   cam.lookfrom = point3(0,0,12);
   cam.lookat   = point3(0.0, 0.0, 0.0);
-  cam.vup      = vec3<double>(0.0, 1.0, 0.0);
+  cam.vup      = vec3<real>(0.0, 1.0, 0.0);
 
   cam.defocus_angle = 0;
 
-  cam.render(hittable_list(globe), timestamp("earth"));
+  render(cam, hittable_list(globe), "earth");
 }
 
 void perlin_spheres() {
@@ -159,12 +247,12 @@ void perlin_spheres() {
   cam.vfov     = 20;
   cam.lookfrom = point3(13.0 , 2.0, 3.0);
   cam.lookat   = point3(0.0, 0.0, 0.0);
-  cam.vup      = vec3<double>(0.0, 1.0, 0.0);
+  cam.vup      = vec3<real>(0.0, 1.0, 0.0);
   cam.background        = color(0.70, 0.80, 1.00);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("perlin-spheres"));
+  render(cam, world, "perlin-spheres");
 }
 
 void quads() {
@@ -176,11 +264,11 @@ void quads() {
   auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
   auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
 
-  world.add(make_shared<quad>(point3(-3.0, -2.0, 5.0), vec3<double>(0.0, 0.0, -4.0), vec3<double>(0.0, 4.0, 0.0), left_red));
-  world.add(make_shared<quad>(point3(-2.0, -2.0, 0.0), vec3<double>(4.0, 0.0, 0.0), vec3<double>(0.0, 4.0, 0.0), back_green));
-  world.add(make_shared<quad>(point3( 3.0, -2.0, 1.0), vec3<double>(0.0, 0.0, 4.0), vec3<double>(0.0, 4.0, 0.0), right_blue));
-  world.add(make_shared<quad>(point3(-2.0,  3.0, 1.0), vec3<double>(4.0, 0.0, 0.0), vec3<double>(0.0, 0.0, 4.0), upper_orange));
-  world.add(make_shared<quad>(point3(-2.0, -3.0, 5.0), vec3<double>(4.0, 0.0, 0.0), vec3<double>(0.0, 0.0,-4.0), lower_teal));
+  world.add(make_shared<quad>(point3(-3.0, -2.0, 5.0), vec3<real>(0.0, 0.0, -4.0), vec3<real>(0.0, 4.0, 0.0), left_red));
+  world.add(make_shared<quad>(point3(-2.0, -2.0, 0.0), vec3<real>(4.0, 0.0, 0.0), vec3<real>(0.0, 4.0, 0.0), back_green));
+  world.add(make_shared<quad>(point3( 3.0, -2.0, 1.0), vec3<real>(0.0, 0.0, 4.0), vec3<real>(0.0, 4.0, 0.0), right_blue));
+  world.add(make_shared<quad>(point3(-2.0,  3.0, 1.0), vec3<real>(4.0, 0.0, 0.0), vec3<real>(0.0, 0.0, 4.0), upper_orange));
+  world.add(make_shared<quad>(point3(-2.0, -3.0, 5.0), vec3<real>(4.0, 0.0, 0.0), vec3<real>(0.0, 0.0,-4.0), lower_teal));
 
   camera cam;
 
@@ -193,11 +281,11 @@ void quads() {
   cam.vfov     = 80;
   cam.lookfrom = point3(0.0, 0.0, 9.0);
   cam.lookat   = point3(0.0, 0.0, 0.0);
-  cam.vup      = vec3<double>(0.0, 1.0, 0.0);
+  cam.vup      = vec3<real>(0.0, 1.0, 0.0);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("quads"));
+  render(cam, world, "quads");
 }
 
 void simple_light() {
@@ -208,8 +296,10 @@ void simple_light() {
   world.add(make_shared<sphere>(point3(0.0, 2.0, 0.0), 2, make_shared<lambertian>(pertext)));
 
   auto difflight = make_shared<diffuse_light>(color(4.0, 4.0, 4.0));
-  world.add(make_shared<sphere>(point3(0.0, 7.0, 0.0), 2, difflight));
-  world.add(make_shared<quad>(point3(3.0, 1.0, -2.0), vec3<double>(2.0, 0.0, 0.0), vec3<double>(0.0, 2.0, 0.0), difflight));
+  hittable_list lights;
+  lights.add(make_shared<sphere>(point3(0.0, 7.0, 0.0), 2, difflight));
+  lights.add(make_shared<quad>(point3(3.0, 1.0, -2.0), vec3<real>(2.0, 0.0, 0.0), vec3<real>(0.0, 2.0, 0.0), difflight));
+  for (const auto& light : lights.objects) world.add(light);
 
   camera cam;
 
@@ -223,11 +313,11 @@ void simple_light() {
   cam.vfov     = 20;
   cam.lookfrom = point3(26,3,6);
   cam.lookat   = point3(0,2,0);
-  cam.vup      = vec3<double>(0,1,0);
+  cam.vup      = vec3<real>(0,1,0);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("simple-light"));
+  render(cam, world, lights, "simple-light");
 }
 
 void cornell_box() {
@@ -238,22 +328,23 @@ void cornell_box() {
   auto green = make_shared<lambertian>(color(.12, .45, .15));
   auto light = make_shared<diffuse_light>(color(15, 15, 15));
 
-  world.add(make_shared<quad>(point3(555,0,0), vec3<double>(0,555,0), vec3<double>(0,0,555), green));
-  world.add(make_shared<quad>(point3(0,0,0), vec3<double>(0,555,0), vec3<double>(0,0,555), red));
-  world.add(make_shared<quad>(point3(343, 554, 332), vec3<double>(-130,0,0), vec3<double>(0,0,-105), light));
-  world.add(make_shared<quad>(point3(0,0,0), vec3<double>(555,0,0), vec3<double>(0,0,555), white));
-  world.add(make_shared<quad>(point3(555,555,555), vec3<double>(-555,0,0), vec3<double>(0,0,-555), white));
-  world.add(make_shared<quad>(point3(0,0,555), vec3<double>(555,0,0), vec3<double>(0,555,0), white));
+  world.add(make_shared<quad>(point3(555,0,0), vec3<real>(0,555,0), vec3<real>(0,0,555), green));
+  world.add(make_shared<quad>(point3(0,0,0), vec3<real>(0,555,0), vec3<real>(0,0,555), red));
+  auto light_quad = make_shared<quad>(point3(343, 554, 332), vec3<real>(-130,0,0), vec3<real>(0,0,-105), light);
+  world.add(light_quad);
+  world.add(make_shared<quad>(point3(0,0,0), vec3<real>(555,0,0), vec3<real>(0,0,555), white));
+  world.add(make_shared<quad>(point3(555,555,555), vec3<real>(-555,0,0), vec3<real>(0,0,-555), white));
+  world.add(make_shared<quad>(point3(0,0,555), vec3<real>(555,0,0), vec3<real>(0,555,0), white));
 
 
   shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
   box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3<double>(265,0,295));
+  box1 = make_shared<translate>(box1, vec3<real>(265,0,295));
   world.add(box1);
 
   shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
   box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3<double>(130,0,65));
+  box2 = make_shared<translate>(box2, vec3<real>(130,0,65));
   world.add(box2);
 
   camera cam;
@@ -267,11 +358,11 @@ void cornell_box() {
   cam.vfov     = 40;
   cam.lookfrom = point3(278, 278, -800);
   cam.lookat   = point3(278, 278, 0);
-  cam.vup      = vec3<double>(0,1,0);
+  cam.vup      = vec3<real>(0,1,0);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("cornell-box"));
+  render(cam, world, hittable_list(light_quad), "cornell-box");
 }
 
 void cornell_smoke() {
@@ -282,20 +373,21 @@ void cornell_smoke() {
   auto green = make_shared<lambertian>(color(.12, .45, .15));
   auto light = make_shared<diffuse_light>(color(7, 7, 7));
 
-  world.add(make_shared<quad>(point3(555,0,0), vec3<double>(0,555,0), vec3<double>(0,0,555), green));
-  world.add(make_shared<quad>(point3(0,0,0), vec3<double>(0,555,0), vec3<double>(0,0,555), red));
-  world.add(make_shared<quad>(point3(113,554,127), vec3<double>(330,0,0), vec3<double>(0,0,305), light));
-  world.add(make_shared<quad>(point3(0,555,0), vec3<double>(555,0,0), vec3<double>(0,0,555), white));
-  world.add(make_shared<quad>(point3(0,0,0), vec3<double>(555,0,0), vec3<double>(0,0,555), white));
-  world.add(make_shared<quad>(point3(0,0,555), vec3<double>(555,0,0), vec3<double>(0,555,0), white));
+  world.add(make_shared<quad>(point3(555,0,0), vec3<real>(0,555,0), vec3<real>(0,0,555), green));
+  world.add(make_shared<quad>(point3(0,0,0), vec3<real>(0,555,0), vec3<real>(0,0,555), red));
+  auto light_quad = make_shared<quad>(point3(113,554,127), vec3<real>(330,0,0), vec3<real>(0,0,305), light);
+  world.add(light_quad);
+  world.add(make_shared<quad>(point3(0,555,0), vec3<real>(555,0,0), vec3<real>(0,0,555), white));
+  world.add(make_shared<quad>(point3(0,0,0), vec3<real>(555,0,0), vec3<real>(0,0,555), white));
+  world.add(make_shared<quad>(point3(0,0,555), vec3<real>(555,0,0), vec3<real>(0,555,0), white));
 
   shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
   box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3<double>(265,0,295));
+  box1 = make_shared<translate>(box1, vec3<real>(265,0,295));
 
   shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
   box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3<double>(130,0,65));
+  box2 = make_shared<translate>(box2, vec3<real>(130,0,65));
 
   world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
   world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
@@ -311,11 +403,11 @@ void cornell_smoke() {
   cam.vfov     = 40;
   cam.lookfrom = point3(278, 278, -800);
   cam.lookat   = point3(278, 278, 0);
-  cam.vup      = vec3<double>(0,1,0);
+  cam.vup      = vec3<real>(0,1,0);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("cornel-smoke"));
+  render(cam, world, hittable_list(light_quad), "cornel-smoke");
 }
 
 void final_scene(int image_width, int samples_per_pixel, int max_depth) {
@@ -339,13 +431,14 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
   hittable_list world;
 
-  world.add(make_shared<bvh_node>(boxes1));
+  world.add(build_bvh(std::move(boxes1)));
 
   auto light = make_shared<diffuse_light>(color(7, 7, 7));
-  world.add(make_shared<quad>(point3(123,554,147), vec3<double>(300,0,0), vec3<double>(0,0,265), light));
+  auto light_quad = make_shared<quad>(point3(123,554,147), vec3<real>(300,0,0), vec3<real>(0,0,265), light);
+  world.add(light_quad);
 
   auto center1 = point3(400, 400, 200);
-  auto center2 = center1 + vec3<double>(30,0,0);
+  auto center2 = center1 + vec3<real>(30,0,0);
   auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
   world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
 
@@ -374,8 +467,8 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
   world.add(make_shared<translate>(
     make_shared<rotate_y>(
-      make_shared<bvh_node>(boxes2), 15),
-      vec3<double>(-100,270,395)
+      make_shared<bvh_node>(std::move(boxes2), opts.bvh), 15),
+      vec3<real>(-100,270,395)
     )
   );
 
@@ -390,11 +483,11 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
   cam.vfov     = 40;
   cam.lookfrom = point3(478, 278, -600);
   cam.lookat   = point3(278, 278, 0);
-  cam.vup      = vec3<double>(0,1,0);
+  cam.vup      = vec3<real>(0,1,0);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("final-scene"));
+  render(cam, world, hittable_list(light_quad), "final-scene");
 }
 
 void triangles() {
@@ -406,7 +499,7 @@ void triangles() {
 
   // Floor
   auto dark_grey = make_shared<lambertian>(color(.1, .1, .1));
-  world.add(make_shared<quad>(point3(-10, 0, -10), vec3<double>(20, 0, 0), vec3<double>(0, 0, 20), dark_grey));
+  world.add(make_shared<quad>(point3(-10, 0, -10), vec3<real>(20, 0, 0), vec3<real>(0, 0, 20), dark_grey));
 
   // pyramid helper
   auto add_pyramid = [&world](
@@ -440,7 +533,7 @@ void triangles() {
   add_pyramid( 0.0, row_z, 1.5, 2.8, blue, blue);
   add_pyramid( 4.0, row_z, 1.5, 2.8, green, green);
 
-  world = hittable_list(make_shared<bvh_node>(world));
+  world = hittable_list(build_bvh(std::move(world)));
 
   camera cam;
 
@@ -453,9 +546,9 @@ void triangles() {
   cam.vfov     = 52;
   cam.lookfrom = point3(0.0, 3.0, 8.0);
   cam.lookat   = point3(0.0, 1.5, row_z);
-  cam.vup      = vec3<double>(0.0, 1.0, 0.0);
+  cam.vup      = vec3<real>(0.0, 1.0, 0.0);
 
-  cam.render(world, timestamp("triangles"));
+  render(cam, world, "triangles");
 }
 
 void showcase_scene() {
@@ -463,39 +556,41 @@ void showcase_scene() {
 
   // Ground
   auto ground = make_shared<metal>(color(0.9, 0.9, 0.9), 0.2);
-  world.add(make_shared<quad>(point3(-20,-5,-20), vec3<double>(40,0,0), vec3<double>(0,0,40), ground));
+  world.add(make_shared<quad>(point3(-20,-5,-20), vec3<real>(40,0,0), vec3<real>(0,0,40), ground));
 
   // Back wall
   auto perlin_tex = make_shared<noise_texture>(2.0);
   auto back_wall = make_shared<lambertian>(perlin_tex);
-  world.add(make_shared<quad>(point3(-20,-5,-20), vec3<double>(40,0,0), vec3<double>(0,25,0), back_wall));
+  world.add(make_shared<quad>(point3(-20,-5,-20), vec3<real>(40,0,0), vec3<real>(0,25,0), back_wall));
 
   // Left wall
   auto checker = make_shared<checker_texture>(1.0, color(0.1, 0.1, 0.1), color(0.8, 0.8, 0.8));
   auto left_wall = make_shared<lambertian>(checker);
-  world.add(make_shared<quad>(point3(-20,-5,-20), vec3<double>(0,0,40), vec3<double>(0,25,0), left_wall));
+  world.add(make_shared<quad>(point3(-20,-5,-20), vec3<real>(0,0,40), vec3<real>(0,25,0), left_wall));
 
   // Right wall
   auto right_wall = make_shared<lambertian>(checker);
-  world.add(make_shared<quad>(point3(20,-5,-20), vec3<double>(0,0,40), vec3<double>(0,25,0), right_wall));
+  world.add(make_shared<quad>(point3(20,-5,-20), vec3<real>(0,0,40), vec3<real>(0,25,0), right_wall));
 
   // Ceiling
   auto ceiling = make_shared<lambertian>(color(0.3, 0.3, 0.3));
-  world.add(make_shared<quad>(point3(-20,20,-20), vec3<double>(40,0,0), vec3<double>(0,0,40), ceiling));
+  world.add(make_shared<quad>(point3(-20,20,-20), vec3<real>(40,0,0), vec3<real>(0,0,40), ceiling));
 
   // Rear wall
   auto rear_wall = make_shared<lambertian>(checker);
-  world.add(make_shared<quad>(point3(-20,-5,20), vec3<double>(40,0,0), vec3<double>(0,25,0), rear_wall));
+  world.add(make_shared<quad>(point3(-20,-5,20), vec3<real>(40,0,0), vec3<real>(0,25,0), rear_wall));
 
   // Vertical emissive bars
+  hittable_list lights;
   auto cool_bar = make_shared<diffuse_light>(color(0.6, 0.8, 1.2));
-  world.add(make_shared<quad>(point3(-15,-2,14), vec3<double>(6,0,0), vec3<double>(0,18,0), cool_bar));
+  lights.add(make_shared<quad>(point3(-15,-2,14), vec3<real>(6,0,0), vec3<real>(0,18,0), cool_bar));
 
   auto neutral_bar = make_shared<diffuse_light>(color(1.0, 0.9, 0.8));
-  world.add(make_shared<quad>(point3(-3,-2,14), vec3<double>(6,0,0), vec3<double>(0,18,0), neutral_bar));
+  lights.add(make_shared<quad>(point3(-3,-2,14), vec3<real>(6,0,0), vec3<real>(0,18,0), neutral_bar));
 
   auto warm_bar = make_shared<diffuse_light>(color(1.6, 1.1, 0.5));
-  world.add(make_shared<quad>(point3(9,-2,14), vec3<double>(6,0,0), vec3<double>(0,18,0), warm_bar));
+  lights.add(make_shared<quad>(point3(9,-2,14), vec3<real>(6,0,0), vec3<real>(0,18,0), warm_bar));
+  for (const auto& light : lights.objects) world.add(light);
 
   // 3x3 grid of spheres
   double sphere_radius = 3;
@@ -544,11 +639,11 @@ void showcase_scene() {
   }
   world.add(make_shared<translate>(
     make_shared<rotate_y>(
-      make_shared<bvh_node>(boxes), 60),
-      vec3<double>(-15, 0, -8)
+      make_shared<bvh_node>(std::move(boxes), opts.bvh), 60),
+      vec3<real>(-15, 0, -8)
   ));
 
-  world = hittable_list(make_shared<bvh_node>(world));
+  world = hittable_list(build_bvh(std::move(world)));
 
   camera cam;
 
@@ -561,19 +656,355 @@ void showcase_scene() {
   cam.vfov     = 70;
   cam.lookfrom = point3(8, 12, 15);
   cam.lookat   = point3(0, 7.5, depth);
-  cam.vup      = vec3<double>(0, 1, 0);
+  cam.vup      = vec3<real>(0, 1, 0);
 
   cam.defocus_angle = 0;
 
-  cam.render(world, timestamp("showcase"));
+  render(cam, world, lights, "showcase");
 }
 
-int main(int argc, char* argv[]) {
+// Loads --mesh=<file.obj|file.ply> onto a ground plane and frames it.
+void mesh_scene() {
+  if (opts.mesh_path.empty()) {
+    std::cerr << "The mesh scene needs --mesh=<file.obj|file.ply>\n";
+    return;
+  }
 
-  int number = -1;
+  mesh_data data;
+  if (!mesh_loader::load(opts.mesh_path, data)) return;
 
-  if (argc > 1)
-    number = std::atoi(argv[1]);
+  auto model = make_shared<triangle_mesh>(
+    std::move(data), make_shared<lambertian>(color(0.73, 0.73, 0.73)), opts.bvh);
+  std::clog << "Mesh BVH built in " << model->build_time_ms() << " ms ("
+            << model->triangle_count() << " triangles, "
+            << model->node_count() << " nodes)\n";
+  auto bounds = model->bounding_box();
+
+  point3 center(
+    0.5 * (bounds.x.min + bounds.x.max),
+    0.5 * (bounds.y.min + bounds.y.max),
+    0.5 * (bounds.z.min + bounds.z.max));
+  double radius = 0.5 * vec3<real>(
+    bounds.x.size(), bounds.y.size(), bounds.z.size()).length();
+
+  hittable_list world;
+  world.add(model);
+
+  auto ground = make_shared<lambertian>(color(0.4, 0.4, 0.4));
+  world.add(make_shared<quad>(
+    point3(center.x() - 50 * radius, bounds.y.min, center.z() - 50 * radius),
+    vec3<real>(100 * radius, 0, 0), vec3<real>(0, 0, 100 * radius), ground));
+
+  camera cam;
+
+  cam.aspect_ratio      = 16.0 / 9.0;
+  cam.image_width       = 800;
+  cam.samples_per_pixel = 100;
+  cam.max_depth         = 20;
+  cam.background        = color(0.70, 0.80, 1.00);
+
+  cam.vfov     = 40;
+  cam.lookat   = center;
+  cam.lookfrom = center + 2.5 * radius * unit_vector(vec3<real>(0.6, 0.4, 1.0));
+  cam.vup      = vec3<real>(0,1,0);
+
+  cam.defocus_angle = 0;
+
+  render(cam, world, "mesh");
+}
+
+// Torus around the y axis, as an indexed mesh with smooth normals.
+mesh_data torus_mesh(double major_radius, double minor_radius, int segments) {
+  mesh_data mesh;
+  const int sides = segments / 2;
+
+  for (int i = 0; i < segments; i++) {
+    for (int j = 0; j < sides; j++) {
+      double u = 2 * pi * i / segments;
+      double v = 2 * pi * j / sides;
+      vec3<real> ring(std::cos(u), 0, std::sin(u));
+      vec3<real> n = std::cos(v) * ring + vec3<real>(0, std::sin(v), 0);
+      point3 p = major_radius * ring + minor_radius * n;
+
+      mesh.positions.push_back(vec3<float>(p.x(), p.y(), p.z()));
+      mesh.normals.push_back(vec3<float>(n.x(), n.y(), n.z()));
+    }
+  }
+
+  auto vertex = [&](int i, int j) {
+    return uint32_t((i % segments) * sides + (j % sides));
+  };
+  for (int i = 0; i < segments; i++) {
+    for (int j = 0; j < sides; j++) {
+      uint32_t quad_corners[4] = {
+        vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1), vertex(i, j + 1)};
+      for (int k : {0, 2, 1, 0, 3, 2}) mesh.indices.push_back(quad_corners[k]);
+    }
+  }
+
+  return mesh;
+}
+
+// A field of 10,000 tori in three materials, all placing one shared mesh: a
+// bvh_node over instances on top, the triangle_mesh BVH underneath.
+void instances() {
+  const int count = 10000;
+
+  std::vector<shared_ptr<material>> materials = {
+    make_shared<lambertian>(color(0.8, 0.3, 0.2)),
+    make_shared<metal>(color(0.8, 0.8, 0.85), 0.2),
+    make_shared<lambertian>(color(0.2, 0.4, 0.8)),
+  };
+  auto torus = make_shared<triangle_mesh>(torus_mesh(1.0, 0.35, 96),
+                                          materials[0], opts.bvh);
+
+  hittable_list tori;
+  for (int i = 0; i < count; i++) {
+    auto position = point3(random_double(-60, 60), 0, random_double(-60, 60));
+    auto scale = random_double(0.3, 0.8);
+    auto placement =
+      affine_transform::translation(position + vec3<real>(0, scale * 0.5, 0))
+      * affine_transform::rotation(vec3<real>::random(-1, 1), random_double(0, 360))
+      * affine_transform::scaling(vec3<real>(scale, scale, scale));
+
+    tori.add(make_shared<instance>(torus, placement,
+                                   materials[random_int(0, 2)]));
+  }
+
+  std::clog << count << " instances sharing one mesh of "
+            << torus->triangle_count() << " triangles\n";
+
+  hittable_list world;
+  world.add(build_bvh(std::move(tori)));
+  world.add(make_shared<quad>(point3(-100, 0, -100), vec3<real>(200, 0, 0),
+                              vec3<real>(0, 0, 200),
+                              make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+  camera cam;
+
+  cam.aspect_ratio      = 16.0 / 9.0;
+  cam.image_width       = 800;
+  cam.samples_per_pixel = 100;
+  cam.max_depth         = 20;
+  cam.background        = color(0.70, 0.80, 1.00);
+
+  cam.vfov     = 35;
+  cam.lookfrom = point3(0, 12, 40);
+  cam.lookat   = point3(0, 0, 0);
+  cam.vup      = vec3<real>(0,1,0);
+
+  cam.defocus_angle = 0;
+
+  render(cam, world, "instances");
+}
+
+// `diff a.hdr b.hdr`: per-channel error between two renders of the same size.
+int diff_images(const char* a_path, const char* b_path) {
+  int aw, ah, bw, bh, channels;
+  float* a = stbi_loadf(a_path, &aw, &ah, &channels, 3);
+  float* b = stbi_loadf(b_path, &bw, &bh, &channels, 3);
+
+  int result = 1;
+  if (!a || !b) {
+    std::cerr << "ERROR: Could not load " << (a ? b_path : a_path) << "\n";
+  } else if (aw != bw || ah != bh) {
+    std::cerr << "ERROR: Image sizes differ: " << aw << "x" << ah << " vs "
+              << bw << "x" << bh << "\n";
+  } else {
+    const size_t n = size_t(aw) * ah * 3;
+    double sum_squared = 0, sum_abs = 0, max_error = 0, peak = 0;
+    for (size_t i = 0; i < n; i++) {
+      double d = double(a[i]) - b[i];
+      sum_squared += d * d;
+      sum_abs += std::fabs(d);
+      max_error = std::fmax(max_error, std::fabs(d));
+      peak = std::fmax(peak, a[i]);
+    }
+
+    double rmse = std::sqrt(sum_squared / n);
+    std::cout << "RMSE: " << rmse << "\n"
+              << "Mean abs error: " << sum_abs / n << "\n"
+              << "Max abs error: " << max_error << "\n";
+    if (rmse > 0) {
+      std::cout << "PSNR: " << 20 * std::log10(std::fmax(peak, 1.0) / rmse)
+                << " dB\n";
+    }
+    result = 0;
+  }
+
+  stbi_image_free(a);
+  stbi_image_free(b);
+  return result;
+}
+
+// Renders the configured `cam` at 1, 4, 9, 16, 36, 64, ... samples per
+// pixel, about doubling each time, and prints the wall-clock time and error
+// of each render against a high-spp reference as CSV rows. Stops after the
+// first render longer than --max-seconds or at 1/16 of the reference's
+// samples, then reports how long the scene takes to reach --target.
+void measure_quality(camera& cam, const hittable& world,
+                     const hittable_list& lights, const std::string& name) {
+  cam.quiet            = true;
+  cam.progressive      = false;
+  cam.write_sample_map = false;
+  cam.write_heatmap    = false;
+  cam.checkpoint_path.clear();
+
+  // Rendered once per scene, size, sample count and seed, then reused. A
+  // different render seed keeps its samples independent of the renders
+  // measured against it.
+  const std::string reference_path =
+      "output/reference-" + name + "-" + std::to_string(cam.image_width) +
+      "w-" + std::to_string(opts.reference_spp) + "spp-" +
+      std::to_string(opts.seed) + ".hdr";
+  int width = 0, height = 0, channels = 0;
+  float* loaded = stbi_loadf(reference_path.c_str(), &width, &height,
+                             &channels, 3);
+  if (!loaded) {
+    std::clog << name << ": rendering reference at " << opts.reference_spp
+              << " spp" << std::endl;
+    camera reference = cam;
+    reference.samples_per_pixel  = opts.reference_spp;
+    reference.adaptive_threshold = 0;
+    reference.sampler            = sampler_type::stratified;
+    reference.denoise            = false;
+    reference.seed               = opts.seed + 1;
+    reference.render(world, lights, reference_path);
+    loaded = stbi_loadf(reference_path.c_str(), &width, &height, &channels, 3);
+    if (!loaded) {
+      std::cerr << "ERROR: Could not load " << reference_path << "\n";
+      return;
+    }
+  }
+  const std::vector<float> reference(loaded,
+                                     loaded + size_t(width) * height * 3);
+  stbi_image_free(loaded);
+
+  std::vector<quality_sample> samples;
+  const int max_spp = std::max(1, opts.reference_spp / 16);
+  int previous_sqrt_spp = 0;
+  for (int k = 0;; k++) {
+    const int sqrt_spp = int(std::lround(std::pow(2.0, k / 2.0)));
+    if (sqrt_spp * sqrt_spp > max_spp) break;
+    if (sqrt_spp == previous_sqrt_spp) continue;
+    previous_sqrt_spp = sqrt_spp;
+
+    cam.samples_per_pixel = sqrt_spp * sqrt_spp;
+    auto start = std::chrono::steady_clock::now();
+    cam.render(world, lights, "");
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    if (cam.image.size() != reference.size()) {
+      std::cerr << "ERROR: " << reference_path << " is " << width << "x"
+                << height << ", not the size of the render\n";
+      return;
+    }
+
+    quality_sample sample;
+    sample.spp = cam.samples_per_pixel;
+    sample.seconds = seconds;
+    sample.error = compare_images(cam.image, reference);
+    samples.push_back(sample);
+    std::cout << name << "," << sample.spp << "," << sample.seconds << ","
+              << sample.error.rmse << "," << sample.error.relmse << std::endl;
+
+    if (seconds > opts.max_seconds) break;
+  }
+
+  const double seconds =
+      time_to_error(samples, opts.target_error,
+                    [](const quality_sample& s) { return s.error.relmse; });
+  std::clog << name << ": ";
+  if (seconds < 0) {
+    std::clog << "relMSE " << opts.target_error << " not reached in "
+              << samples.back().seconds << " s";
+  } else {
+    std::clog << seconds << " s to relMSE " << opts.target_error;
+  }
+  std::clog << std::endl;
+}
+
+// Parses one `--key=value` argument, or a bare `--flag`, into opts.
+bool parse_option(const std::string& arg) {
+  if (arg.rfind("--", 0) != 0) return false;
+
+  auto eq = arg.find('=');
+  auto key = arg.substr(2, eq == std::string::npos ? eq : eq - 2);
+  auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+  if (key == "bvh" && value == "median") {
+    opts.bvh = bvh_split::median;
+  } else if (key == "bvh" && value == "sah") {
+    opts.bvh = bvh_split::sah;
+  } else if (key == "threads") {
+    opts.threads = std::atoi(value.c_str());
+  } else if (key == "tile") {
+    opts.tile_size = std::atoi(value.c_str());
+  } else if (key == "adaptive") {
+    opts.adaptive_threshold = std::atof(value.c_str());
+  } else if (key == "min-spp") {
+    opts.min_spp = std::atoi(value.c_str());
+  } else if (key == "sample-map") {
+    opts.sample_map = true;
+  } else if (key == "no-light-sampling") {
+    opts.light_sampling = false;
+  } else if (key == "packets") {
+    opts.packets = true;
+  } else if (key == "sampler" && value == "independent") {
+    opts.sampler = sampler_type::independent;
+  } else if (key == "sampler" && value == "stratified") {
+    opts.sampler = sampler_type::stratified;
+  } else if (key == "sampler" && value == "sobol") {
+    opts.sampler = sampler_type::sobol;
+  } else if (key == "sampler" && value == "blue-noise") {
+    opts.sampler = sampler_type::blue_noise;
+  } else if (key == "spp") {
+    opts.spp = std::atoi(value.c_str());
+  } else if (key == "width") {
+    opts.width = std::atoi(value.c_str());
+  } else if (key == "reference-spp") {
+    opts.reference_spp = std::atoi(value.c_str());
+  } else if (key == "target") {
+    opts.target_error = std::atof(value.c_str());
+  } else if (key == "max-seconds") {
+    opts.max_seconds = std::atof(value.c_str());
+  } else if (key == "seed") {
+    opts.seed = std::atoll(value.c_str());
+  } else if (key == "render-seed") {
+    opts.render_seed = std::atoll(value.c_str());
+  } else if (key == "mesh") {
+    opts.mesh_path = value;
+  } else if (key == "output") {
+    opts.output = value;
+  } else if (key == "checkpoint") {
+    opts.checkpoint = value;
+  } else if (key == "checkpoint-interval") {
+    opts.checkpoint_interval = std::atof(value.c_str());
+  } else if (key == "resume") {
+    opts.resume = true;
+  } else if (key == "progressive") {
+    opts.progressive = true;
+  } else if (key == "snapshot-interval") {
+    opts.snapshot_interval = std::atof(value.c_str());
+  } else if (key == "denoise") {
+    opts.denoise = true;
+  } else if (key == "heatmap" && (value.empty() || value == "camera")) {
+    opts.heatmap = true;
+  } else if (key == "heatmap" && value == "path") {
+    opts.heatmap = true;
+    opts.heatmap_paths = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Builds and renders scene `number` with the layout drawn from opts.seed.
+void run_scene(int number) {
+  // Scenes draw their random layouts on this thread, so with the seed
+  // printed after a render, --seed reproduces it exactly.
+  thread_rng().seed(mix_bits(uint64_t(opts.seed)), 0);
+  opts.scene = number;
 
   switch (number) {
     case 1:  bouncing_spheres();          break;
@@ -587,7 +1018,84 @@ int main(int argc, char* argv[]) {
     case 9:  final_scene(800, 10000, 40); break;
     case 10: final_scene(400, 250, 4);    break;
     case 11: triangles();                 break;
+    case 12: mesh_scene();                break;
+    case 13: instances();                 break;
     default: showcase_scene();            break;
   }
+}
+
+// `quality [scene...] [options...]`: time-to-quality CSV for each scene,
+// by default the Cornell box, Cornell smoke, triangles and showcase scenes.
+int measure_scenes(int argc, char* argv[]) {
+  std::vector<int> scenes;
+  for (int i = 2; i < argc; i++) {
+    if (argv[i][0] != '-') {
+      scenes.push_back(std::atoi(argv[i]));
+    } else if (!parse_option(argv[i])) {
+      std::cerr << "Unknown option: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+  if (scenes.empty()) scenes = {7, 8, 11, 0};
+
+  // A fixed default seed lets later runs reuse the references.
+  if (opts.seed < 0) opts.seed = 1;
+  if (opts.width <= 0) opts.width = 200;
+  opts.quality = true;
+
+  std::cout << "scene,spp,seconds,rmse,relmse" << std::endl;
+  for (int number : scenes) run_scene(number);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+
+  int number = -1;
+
+  if (argc > 1 && std::string(argv[1]) == "diff") {
+    if (argc != 4) {
+      std::cerr << "Usage: " << argv[0] << " diff <a.hdr> <b.hdr>\n";
+      return 1;
+    }
+    return diff_images(argv[2], argv[3]);
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "quality") {
+    return measure_scenes(argc, argv);
+  }
+
+  if (argc > 1)
+    number = std::atoi(argv[1]);
+
+  for (int i = 2; i < argc; i++) {
+    if (!parse_option(argv[i])) {
+      std::cerr << "Unknown option: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  if (opts.heatmap && !render_stats_enabled) {
+    std::cerr << "ERROR: --heatmap needs a build with -DRAYTRACER_STATS=ON\n";
+    return 1;
+  }
+
+  if (opts.resume && opts.checkpoint.empty()) {
+    std::cerr << "ERROR: --resume needs --checkpoint=<file>\n";
+    return 1;
+  }
+
+  // A resumed render rebuilds the scene from the checkpoint's seed.
+  if (opts.resume && opts.seed < 0 && opts.render_seed < 0 &&
+      render_checkpoint::exists(opts.checkpoint)) {
+    render_checkpoint header;
+    if (!header.read(opts.checkpoint, true)) return 1;
+    opts.seed = int64_t(header.seed);
+  }
+
+  if (opts.seed < 0) {
+    std::random_device rd;
+    opts.seed = int64_t(((uint64_t(rd()) << 32) ^ rd()) >> 1);
+  }
+  run_scene(number);
   return 0;
 }